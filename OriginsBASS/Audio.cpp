@@ -3,7 +3,23 @@
 #include "Helpers.h"
 #include "SigScan.h"
 #include "IniFile.hpp"
+#include "Config.hpp"
+#include "WorkerPool.hpp"
+#include "MPSCQueue.hpp"
+#include "TempoQuality.hpp"
+#include "Prerender.hpp"
+#include "DecoderPool.hpp"
+#include "MusicCache.hpp"
+#include "DecodeAhead.hpp"
+#include "BufferMonitor.hpp"
+#include "Latency.hpp"
+#include "Resampler.hpp"
+#include "SFXStorage.hpp"
+#include "SFXPool.hpp"
+#include "PCMCache.hpp"
+#include "Hash.hpp"
 #include "mod.hpp"
+#include <algorithm>
 
 namespace OriginsBASS {
     namespace Audio {
@@ -12,36 +28,475 @@ namespace OriginsBASS {
         AudioChannel channels[CHANNEL_COUNT];
         float globalVolume = 1.0f;
 
+        // SFX file reads are handed off to these so StageLoad doesn't block on disk
+        static WorkerPool sfxLoader;
+        static std::mutex sfxLoadLock;
+        static std::condition_variable sfxLoadSignal;
+        // Reads queued and not finished yet. Memory use is reported each time this drops back to 0
+        static std::atomic<uint32> sfxPending{ 0 };
+        // Rate the device runs at. SFX at other rates are converted when loaded so voices play without resampling
+        static uint32 outputRate = 0;
+
+        // How long the old and new stream overlap when a voice moves on or off the tempo processor
+        const DWORD TEMPO_CROSSFADE_MS = 20;
+
+        // Hooks post commands here so they never wait on BASS. While the audio thread runs it is
+        // the only one that touches channels[], apart from the atomics GetChannelState reads
+        static MPSCQueue<AudioCommand, 0x100> commandQueue;
+        static HANDLE commandEvent = nullptr;
+        static std::atomic<bool> commandThreadWaiting{ false };
+        static bool commandThreadRunning = false;
+
+        // SFX that ended on the mixer thread, at most one per channel. They're left here rather than queued so the
+        // mixer never waits on a full queue, and a later end on the same channel just replaces the earlier one
+        static std::atomic<VoiceHandle> endedSFX[CHANNEL_COUNT];
+        static std::atomic<bool> endedSFXPending{ false };
+
+        static void Submit(const AudioCommand& command);
+        static void SetVoiceSync(uint32 channel);
+        static void StartDecodedStream(VoiceHandle voice);
+        static void UsePrerender(VoiceHandle voice, float speed);
+
+        static double VariantScale(float variantSpeed) { return variantSpeed ? variantSpeed : 1.0; }
+
+        // Converts source bytes to bytes in the file a voice is actually playing
+        static QWORD ToVariantBytes(DWORD stream, float variantSpeed, QWORD sourceBytes) {
+            if (!variantSpeed)
+                return sourceBytes;
+            return BASS_ChannelSeconds2Bytes(stream, BASS_ChannelBytes2Seconds(stream, sourceBytes) / variantSpeed);
+        }
+
         // Event
         static void __stdcall EventLoopTrack(HSYNC handle, DWORD channel, DWORD data, void* user) {
-            AudioChannel* channelEntry = &channels[reinterpret_cast<uintptr_t>(user) & 0x0F];
-            BASS_ChannelSetPosition(channel, channelEntry->loopStart, BASS_POS_BYTE);
+            VoiceHandle voice = (VoiceHandle) reinterpret_cast<uintptr_t>(user);
+            if (!IsVoiceCurrent(voice))
+                return;
+
+            AudioChannel* channelEntry = &channels[GetVoiceChannel(voice)];
+            BASS_ChannelSetPosition(channel, ToVariantBytes(channel, channelEntry->variantSpeed, channelEntry->loopStart), BASS_POS_BYTE);
+        }
+
+        // The channel may already be playing something else by the time this runs
+        static void ClearEndedSFX(VoiceHandle voice) {
+            if (IsVoiceCurrent(voice))
+                channels[GetVoiceChannel(voice)].soundID = -1;
         }
 
+        static void DrainEndedSFX() {
+            if (!endedSFXPending.exchange(false))
+                return;
+            for (int i = 0; i < CHANNEL_COUNT; ++i) {
+                VoiceHandle voice = endedSFX[i].exchange(VOICE_NONE);
+                if (voice != VOICE_NONE)
+                    ClearEndedSFX(voice);
+            }
+        }
+
+        // Runs on the BASS mixer thread, so it only leaves the voice for the audio thread and never blocks
         static void __stdcall EventClearSFX(HSYNC handle, DWORD channel, DWORD data, void* user) {
-            channels[reinterpret_cast<uintptr_t>(user) & 0x0F].soundID = -1;
+            VoiceHandle voice = (VoiceHandle) reinterpret_cast<uintptr_t>(user);
+            if (!commandThreadRunning) {
+                ClearEndedSFX(voice);
+                return;
+            }
+
+            endedSFX[GetVoiceChannel(voice)].store(voice);
+            endedSFXPending.store(true);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (commandThreadWaiting.load())
+                SetEvent(commandEvent);
         }
 
-        void ResetChannels() {
-            for (int i = 0; i < CHANNEL_COUNT; ++i)
-                StopChannel(i);
+        static void ExecuteCommand(const AudioCommand& command) {
+            switch (command.type) {
+                case AUDIOCMD_PLAY_SFX: PlaySfx(command.sfx, command.loopPoint, command.priority, command.issued); break;
+                case AUDIOCMD_PLAY_STREAM: StartStream(command.filename, command.channel, command.startPos, command.loopPoint); break;
+                case AUDIOCMD_STOP_CHANNEL: StopChannel(command.channel); break;
+                case AUDIOCMD_PAUSE_CHANNEL: PauseChannel(command.channel); break;
+                case AUDIOCMD_RESUME_CHANNEL: ResumeChannel(command.channel); break;
+                case AUDIOCMD_SET_ATTRIBUTES: SetChannelAttributes(command.channel, command.volume, command.panning, command.speed); break;
+                case AUDIOCMD_RESET_CHANNELS: ResetChannels(); break;
+                case AUDIOCMD_STREAM_DECODED: StartDecodedStream(command.voice); break;
+                case AUDIOCMD_PRERENDERED: UsePrerender(command.voice, command.speed); break;
+                case AUDIOCMD_UPDATE:
+                    TempoQuality::Update();
+                    BufferMonitor::Update();
+                    Latency::Update();
+                    break;
+            }
+
+            if (!command.predicted)
+                return;
+            if (command.type == AUDIOCMD_RESET_CHANNELS) {
+                for (int i = 0; i < CHANNEL_COUNT; ++i)
+                    channels[i].pendingCommands.fetch_sub(1, std::memory_order_release);
+            }
+            else {
+                channels[command.channel].pendingCommands.fetch_sub(1, std::memory_order_release);
+            }
         }
 
-        void StopChannel(uint32 channel) {
-            if (channel >= CHANNEL_COUNT) {
-                printf("[OriginsBASS] Attempt to release channel out of bounds. channel = %u\n", channel);
+        static void CommandThreadMain() {
+            AudioCommand command;
+            for (;;) {
+                while (commandQueue.TryPop(command)) {
+                    DrainEndedSFX();
+                    ExecuteCommand(command);
+                }
+                DrainEndedSFX();
+
+                // Check once more after announcing we're going to sleep, a producer either sees the flag or we see its work
+                commandThreadWaiting.store(true);
+                if (endedSFXPending.load()) {
+                    commandThreadWaiting.store(false);
+                    continue;
+                }
+                if (commandQueue.TryPop(command)) {
+                    commandThreadWaiting.store(false);
+                    ExecuteCommand(command);
+                    continue;
+                }
+                WaitForSingleObject(commandEvent, INFINITE);
+                commandThreadWaiting.store(false);
+            }
+        }
+
+        // Runs on the render thread
+        static void PrerenderReady(uint32 voice, float speed) {
+            AudioCommand command{};
+            command.type    = AUDIOCMD_PRERENDERED;
+            command.voice   = voice;
+            command.channel = GetVoiceChannel(voice);
+            command.speed   = speed;
+            Submit(command);
+        }
+
+        static void Submit(const AudioCommand& command) {
+            if (!commandThreadRunning) {
+                ExecuteCommand(command);
+                return;
+            }
+
+            while (!commandQueue.TryPush(command))
+                std::this_thread::yield();
+
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (commandThreadWaiting.load())
+                SetEvent(commandEvent);
+        }
+
+        // Lets GetChannelState answer for commands the audio thread hasn't run yet
+        static bool PredictState(uint32 channel, uint8 state) {
+            if (!commandThreadRunning || channel >= CHANNEL_COUNT)
+                return false;
+
+            channels[channel].requestedState.store(state, std::memory_order_relaxed);
+            channels[channel].pendingCommands.fetch_add(1, std::memory_order_release);
+            return true;
+        }
+
+        void StartCommandThread() {
+            if (commandThreadRunning)
+                return;
+
+            commandEvent = CreateEventA(nullptr, false, false, nullptr);
+            if (!commandEvent) {
+                printf("[OriginsBASS] Failed to create audio command event, running commands on the game thread\n");
                 return;
             }
 
+            commandThreadRunning = true;
+            std::thread(CommandThreadMain).detach();
+            // Without this thread a finished render is picked up by the next speed change instead
+            Prerender::SetReadyCallback(PrerenderReady);
+            printf("[OriginsBASS] Started audio command thread\n");
+        }
+
+        uint8 GetChannelState(uint32 channel) {
+            if (channel >= CHANNEL_COUNT)
+                return CHANNEL_IDLE;
+
+            AudioChannel* channelEntry = &channels[channel];
+            if (channelEntry->pendingCommands.load(std::memory_order_acquire))
+                return channelEntry->requestedState.load(std::memory_order_relaxed);
+            return channelEntry->state.load(std::memory_order_acquire);
+        }
+
+        void QueuePlaySfx(uint16 sfx, uint32 loopPoint, uint32 priority) {
+            AudioCommand command{};
+            command.type      = AUDIOCMD_PLAY_SFX;
+            command.sfx       = sfx;
+            command.loopPoint = loopPoint;
+            command.priority  = priority;
+            command.issued    = Latency::Now();
+
+            // A load still in flight is waited out here on the game thread, never on the audio thread
+            if (sfx < SFX_COUNT && soundFXList[sfx].loadState.load(std::memory_order_acquire) == SFX_LOADING) {
+                if (Config::sfxNotReadyPolicy == Config::SFX_NOTREADY_DROP)
+                    return;
+                WaitForSFX(sfx);
+            }
+            Submit(command);
+        }
+
+        void QueuePlayStream(const char* filename, uint32 channel, uint32 startPos, uint32 loopPoint, bool fileFound) {
+            AudioCommand command{};
+            command.type      = AUDIOCMD_PLAY_STREAM;
+            command.channel   = channel;
+            command.startPos  = startPos;
+            command.loopPoint = loopPoint;
+            strncpy_s(command.filename, filename, _TRUNCATE);
+            command.predicted = fileFound && PredictState(channel, CHANNEL_STREAM);
+            Submit(command);
+        }
+
+        void QueueStopChannel(uint32 channel) {
+            AudioCommand command{};
+            command.type      = AUDIOCMD_STOP_CHANNEL;
+            command.channel   = channel;
+            command.predicted = PredictState(channel, CHANNEL_IDLE);
+            Submit(command);
+        }
+
+        void QueuePauseChannel(uint32 channel) {
+            AudioCommand command{};
+            command.type      = AUDIOCMD_PAUSE_CHANNEL;
+            command.channel   = channel;
+            command.predicted = PredictState(channel, GetChannelState(channel) | CHANNEL_PAUSED);
+            Submit(command);
+        }
+
+        void QueueResumeChannel(uint32 channel) {
+            AudioCommand command{};
+            command.type      = AUDIOCMD_RESUME_CHANNEL;
+            command.channel   = channel;
+            command.predicted = PredictState(channel, GetChannelState(channel) & ~CHANNEL_PAUSED);
+            Submit(command);
+        }
+
+        void QueueSetChannelAttributes(uint32 channel, float volume, float panning, float speed) {
+            AudioCommand command{};
+            command.type    = AUDIOCMD_SET_ATTRIBUTES;
+            command.channel = channel;
+            command.volume  = volume;
+            command.panning = panning;
+            command.speed   = speed;
+            Submit(command);
+        }
+
+        // Periodic housekeeping, posted once a frame
+        void QueueUpdate() {
+            AudioCommand command{};
+            command.type = AUDIOCMD_UPDATE;
+            Submit(command);
+        }
+
+        void QueueResetChannels() {
+            AudioCommand command{};
+            command.type = AUDIOCMD_RESET_CHANNELS;
+            if (commandThreadRunning) {
+                for (int i = 0; i < CHANNEL_COUNT; ++i)
+                    PredictState(i, CHANNEL_IDLE);
+                command.predicted = true;
+            }
+            Submit(command);
+        }
+
+        void InitLoader(uint32 threadCount) {
+            BASS_INFO info;
+            if (BASS_GetInfo(&info) && info.freq) {
+                outputRate = info.freq;
+                printf("[OriginsBASS] Output at %u Hz, SFX are converted to it when loaded\n", outputRate);
+            }
+
+            sfxLoader.Start(threadCount);
+            printf("[OriginsBASS] Started %u SFX loader thread(s)\n", sfxLoader.ThreadCount());
+        }
+
+        // Only the thread that owns channels[] changes generations
+        static VoiceHandle NextVoice(uint32 channel) {
+            uint32 generation = channels[channel].generation.load(std::memory_order_relaxed) + 1;
+            if (generation > VOICE_GENERATION_MAX)
+                generation = 1;
+            channels[channel].generation.store(generation, std::memory_order_release);
+            return MakeVoiceHandle(channel, generation);
+        }
+
+        bool IsVoiceCurrent(VoiceHandle voice) {
+            if (voice == VOICE_NONE)
+                return false;
+            return channels[GetVoiceChannel(voice)].generation.load(std::memory_order_acquire) == GetVoiceGeneration(voice);
+        }
+
+        // Hands a stopped file stream to the decoder pool. SFX play from memory and aren't worth keeping,
+        // and deck streams own two decoders
+        static bool KeepWarm(uint32 channel) {
+            AudioChannel* channelEntry = &channels[channel];
+            if (channelEntry->sourceBuffer || channelEntry->deck)
+                return false;
+
+            if (channelEntry->sync)
+                BASS_ChannelRemoveSync(DecodeAhead::Source(channelEntry->basschan), channelEntry->sync);
+            const char* path = channelEntry->variantSpeed ? channelEntry->variantPath : channelEntry->sourcePath;
+            DWORD flags      = channelEntry->sourceLoops ? BASS_SAMPLE_LOOP : 0;
+            // The pool keeps the decoder, a wrapped one gets a new ring when it is picked up again
+            HSTREAM stream = DecodeAhead::Unwrap(channelEntry->basschan);
+            if (!DecoderPool::Release(path, flags, channelEntry->tempoActive, stream))
+                BASS_StreamFree(stream);
+            return true;
+        }
+
+        // Music voices that were stopped or replaced while they played, kept paused so the game
+        // can go back to them after a jingle. Top of the stack is the most recent
+        struct SuspendedVoice {
+            uint32 channel;
+            DWORD basschan;
+            int32 loopStart;
+            int32 loopEnd;
+            char name[MAX_PATH];
+            float streamSpeed;
+            char sourcePath[MAX_PATH];
+            bool sourceLoops;
+            bool tempoActive;
+            HSYNC sync;
+            float variantSpeed;
+            char variantPath[MAX_PATH];
+            DualDeck::Deck* deck;
+            char altName[MAX_PATH];
+            DWORD positionStream;
+        };
+        static std::vector<SuspendedVoice> suspendedVoices;
+
+        static void FreeSuspended(size_t index) {
+            BASS_StreamFree(suspendedVoices[index].basschan);
+            suspendedVoices.erase(suspendedVoices.begin() + index);
+        }
+
+        static bool SuspendVoice(uint32 channel) {
+            AudioChannel* channelEntry = &channels[channel];
+            if (!Config::suspendDepth || channelEntry->sourceBuffer || !channelEntry->name[0])
+                return false;
+            if ((channelEntry->state & 0x3F) != CHANNEL_STREAM || BASS_ChannelIsActive(channelEntry->basschan) == BASS_ACTIVE_STOPPED)
+                return false;
+
+            // Pausing keeps the decoder, the tempo state and the position exactly where they are
+            BASS_ChannelPause(channelEntry->basschan);
+            if (suspendedVoices.size() >= Config::suspendDepth)
+                FreeSuspended(0);
+
+            SuspendedVoice voice;
+            voice.channel        = channel;
+            voice.basschan       = channelEntry->basschan;
+            voice.loopStart      = channelEntry->loopStart;
+            voice.loopEnd        = channelEntry->loopEnd;
+            voice.streamSpeed    = channelEntry->streamSpeed;
+            voice.sourceLoops    = channelEntry->sourceLoops;
+            voice.tempoActive    = channelEntry->tempoActive;
+            voice.sync           = channelEntry->sync;
+            voice.variantSpeed   = channelEntry->variantSpeed;
+            voice.deck           = channelEntry->deck;
+            voice.positionStream = channelEntry->positionStream.load(std::memory_order_relaxed);
+            strcpy_s(voice.name, channelEntry->name);
+            strcpy_s(voice.sourcePath, channelEntry->sourcePath);
+            strcpy_s(voice.variantPath, channelEntry->variantPath);
+            strcpy_s(voice.altName, channelEntry->altName);
+            suspendedVoices.push_back(voice);
+
+            printf("[OriginsBASS] Suspended \"%s\" in channel %u\n", voice.name, channel);
+            return true;
+        }
+
+        static void ReleaseVoice(uint32 channel, bool suspend) {
             if (channels[channel].basschan) {
-                if (BASS_ChannelIsActive(channels[channel].basschan) != BASS_ACTIVE_STOPPED)
-                BASS_ChannelStop(channels[channel].basschan);
-                BASS_StreamFree(channels[channel].basschan);
+                if (!suspend || !SuspendVoice(channel)) {
+                    if (BASS_ChannelIsActive(channels[channel].basschan) != BASS_ACTIVE_STOPPED)
+                    BASS_ChannelStop(channels[channel].basschan);
+                    if (!KeepWarm(channel))
+                        BASS_StreamFree(channels[channel].basschan);
+                }
                 channels[channel].basschan = NULL;
+                NextVoice(channel);
+                channels[channel].tempoActive = false;
+                channels[channel].variantSpeed = 0.0f;
+                channels[channel].deck = nullptr;
+                // The decoder is freed or parked with the voice, position reads must not reach it any more
+                channels[channel].positionStream.store(0, std::memory_order_release);
+                channels[channel].altName[0] = '\0';
+                channels[channel].sync = 0;
                 channels[channel].streamSpeed = 1.0f;
                 channels[channel].soundID = -1;
                 channels[channel].state = CHANNEL_IDLE;
             }
+            else if (channels[channel].state == CHANNEL_LOADING_STREAM) {
+                // Drops the stream that is waiting for its decode
+                NextVoice(channel);
+                channels[channel].state = CHANNEL_IDLE;
+            }
+        }
+
+        void ResetChannels() {
+            while (!suspendedVoices.empty())
+                FreeSuspended(suspendedVoices.size() - 1);
+            for (int i = 0; i < CHANNEL_COUNT; ++i)
+                ReleaseVoice(i, false);
+        }
+
+        bool ResumeSuspended(uint32 channel, const char* name) {
+            size_t index = suspendedVoices.size();
+            while (index && (suspendedVoices[index - 1].channel != channel || strcmp(suspendedVoices[index - 1].name, name)))
+                --index;
+            if (!index)
+                return false;
+            --index;
+
+            // Whatever played over it is done, and so is anything that was suspended on top of it
+            ReleaseVoice(channel, false);
+            for (size_t i = suspendedVoices.size() - 1; i > index; --i) {
+                if (suspendedVoices[i].channel == channel)
+                    FreeSuspended(i);
+            }
+
+            SuspendedVoice voice       = suspendedVoices[index];
+            suspendedVoices.erase(suspendedVoices.begin() + index);
+            AudioChannel* channelEntry = &channels[channel];
+            channelEntry->basschan     = voice.basschan;
+            channelEntry->loopStart    = voice.loopStart;
+            channelEntry->loopEnd      = voice.loopEnd;
+            channelEntry->streamSpeed  = voice.streamSpeed;
+            channelEntry->sourceBuffer = nullptr;
+            channelEntry->sourceLength = 0;
+            channelEntry->sourceLoops  = voice.sourceLoops;
+            channelEntry->tempoActive  = voice.tempoActive;
+            channelEntry->variantSpeed = voice.variantSpeed;
+            channelEntry->deck         = voice.deck;
+            channelEntry->positionStream.store(voice.positionStream, std::memory_order_release);
+            strcpy_s(channelEntry->name, voice.name);
+            strcpy_s(channelEntry->sourcePath, voice.sourcePath);
+            strcpy_s(channelEntry->variantPath, voice.variantPath);
+            strcpy_s(channelEntry->altName, voice.altName);
+
+            // The old loop event carries the previous voice handle
+            NextVoice(channel);
+            if (voice.sync)
+                BASS_ChannelRemoveSync(DecodeAhead::Source(voice.basschan), voice.sync);
+            if (voice.deck)
+                channelEntry->sync = 0;
+            else
+                SetVoiceSync(channel);
+
+            channelEntry->state = CHANNEL_STREAM;
+            BASS_ChannelPlay(voice.basschan, false);
+            printf("[OriginsBASS] Resumed \"%s\" in channel %u\n", name, channel);
+            return true;
+        }
+
+        void StopChannel(uint32 channel) {
+            if (channel >= CHANNEL_COUNT) {
+                printf("[OriginsBASS] Attempt to release channel out of bounds. channel = %u\n", channel);
+                return;
+            }
+
+            ReleaseVoice(channel, true);
         }
 
         void PauseChannel(uint32 channel) {
@@ -74,11 +529,24 @@ namespace OriginsBASS {
                 return;
             }
 
-            if (channels[channel].basschan != 0) {
+            if (channels[channel].deck) {
+                // The deck stream can't seek, its decoder does. Decoders output floats
+                DWORD decoder = channels[channel].positionStream.load(std::memory_order_acquire);
+                BASS_CHANNELINFO info;
+                if (BASS_ChannelGetInfo(decoder, &info))
+                    BASS_ChannelSetPosition(decoder, (QWORD)startPos * info.chans * sizeof(float), BASS_POS_BYTE);
                 BASS_ChannelPlay(channels[channel].basschan, true);
-                BASS_ChannelSetPosition(channels[channel].basschan, startPos * 4, BASS_POS_BYTE);
                 channels[channel].state = CHANNEL_STREAM;
-          }
+            }
+            else if (channels[channel].basschan != 0) {
+                // Voices are always fresh here, seeking first means a decode-ahead ring starts at the right place
+                DecodeAhead::SetPosition(channels[channel].basschan, startPos * 4);
+                BASS_ChannelPlay(channels[channel].basschan, false);
+                channels[channel].state = CHANNEL_STREAM;
+            }
+            else if (channels[channel].state == CHANNEL_LOADING_STREAM) {
+                channels[channel].pendingStartPos = startPos;
+            }
         }
 
         void SetChannelAttributes(uint32 channel, float volume, float panning, float speed) {
@@ -96,56 +564,432 @@ namespace OriginsBASS {
             printf("[OriginsBASS] Ch: %u, Vol: %f, Tem: %f\n", channel, volume, speed);
             BASS_ChannelSetAttribute(channels[channel].basschan, BASS_ATTRIB_VOL, volume * globalVolume);
             BASS_ChannelSetAttribute(channels[channel].basschan, BASS_ATTRIB_PAN, panning);
-            BASS_ChannelSetAttribute(channels[channel].basschan, BASS_ATTRIB_TEMPO, (speed - 1.0f) * 100.0f);
+            SetChannelSpeed(channel, speed);
+        }
+
+        // Music decoders are handed to the decode-ahead thread when it's enabled
+        static HSTREAM FinishVoiceStream(HSTREAM stream, bool decodeAhead) {
+            if (!decodeAhead)
+                return stream;
+            HSTREAM output = DecodeAhead::Wrap(stream);
+            if (!output)
+                BASS_StreamFree(stream);
+            return output;
         }
 
-        void LoadStream(uint32 channel, const char* filename, const char* name, int32 loopStart, int32 loopEnd) {
+        // Voices start on a plain stream. The tempo processor is only put in while the speed isn't 1.0
+        static HSTREAM CreateVoiceStream(const AudioChannel* channelEntry, bool useTempo, const char* variantPath = nullptr) {
+            // Files that were playing a moment ago may still be open. SFX play from memory and are left alone
+            const char* filePath = variantPath ? variantPath : channelEntry->sourceBuffer ? nullptr : channelEntry->sourcePath;
+            bool decodeAhead     = filePath && DecodeAhead::Enabled();
+            DWORD loopFlag       = channelEntry->sourceLoops ? BASS_SAMPLE_LOOP : 0;
+            DWORD decodeFlag     = decodeAhead ? BASS_STREAM_DECODE : 0;
+            DWORD flags          = loopFlag | (useTempo ? BASS_STREAM_DECODE : decodeFlag);
+
+            if (filePath) {
+                HSTREAM pooled = DecoderPool::Acquire(filePath, loopFlag, useTempo);
+                if (pooled) {
+                    if (useTempo)
+                        TempoQuality::Apply(pooled);
+                    return FinishVoiceStream(pooled, decodeAhead);
+                }
+            }
+
+            HSTREAM stream = 0;
+            if (variantPath) {
+                stream = BASS_StreamCreateFile(false, variantPath, 0, 0, flags);
+            }
+            else if (channelEntry->sourceBuffer) {
+                if ((stream = SFXStorage::CreateStream(channelEntry->sourceBuffer, channelEntry->sourceLength, flags)))
+                    SFXPool::Hold(stream, channelEntry->sourceBuffer);
+            }
+            else if (!(stream = MusicCache::CreateStream(channelEntry->sourcePath, flags))) {
+                stream = BASS_StreamCreateFile(false, channelEntry->sourcePath, 0, 0, flags);
+            }
+            if (!stream || !useTempo)
+                return stream ? FinishVoiceStream(stream, decodeAhead) : 0;
+
+            HSTREAM tempo = BASS_FX_TempoCreate(stream, loopFlag | decodeFlag | BASS_FX_FREESOURCE);
+            if (!tempo) {
+                BASS_StreamFree(stream);
+                return 0;
+            }
+            TempoQuality::Apply(tempo);
+            return FinishVoiceStream(tempo, decodeAhead);
+        }
+
+        static void SetVoiceSync(uint32 channel) {
+            AudioChannel* channelEntry = &channels[channel];
+            // Loop events seek the decoder itself, so with decode-ahead they happen as the ring is filled
+            DWORD source = DecodeAhead::Source(channelEntry->basschan);
+            void* user   = reinterpret_cast<void*>((QWORD)MakeVoiceHandle(channel, channelEntry->generation.load(std::memory_order_relaxed)));
+
+            if (channelEntry->sourceBuffer)
+                channelEntry->sync = BASS_ChannelSetSync(source, BASS_SYNC_END | BASS_SYNC_MIXTIME, 0, EventClearSFX, user);
+            else if (!channelEntry->sourceLoops)
+                channelEntry->sync = 0;
+            else if (channelEntry->loopEnd == -1)
+                channelEntry->sync = BASS_ChannelSetSync(source, BASS_SYNC_END, 0, EventLoopTrack, user);
+            else
+                channelEntry->sync = BASS_ChannelSetSync(source, BASS_SYNC_POS,
+                                                         ToVariantBytes(source, channelEntry->variantSpeed, channelEntry->loopEnd), EventLoopTrack, user);
+        }
+
+        // Reopens the voice at the same point in the track, with or without the tempo processor
+        // or on a pre-rendered variant. The old stream fades out while the new one fades in, so there's no click
+        static void SwitchVoicePath(uint32 channel, bool useTempo, float variantSpeed, const char* variantPath) {
+            AudioChannel* channelEntry = &channels[channel];
+            HSTREAM oldStream = channelEntry->basschan;
+            HSTREAM newStream = CreateVoiceStream(channelEntry, useTempo, variantSpeed ? variantPath : nullptr);
+            if (!newStream)
+                return;
+
+            float volume  = globalVolume;
+            float panning = 0.0f;
+            BASS_ChannelGetAttribute(oldStream, BASS_ATTRIB_VOL, &volume);
+            BASS_ChannelGetAttribute(oldStream, BASS_ATTRIB_PAN, &panning);
+            double seconds = BASS_ChannelBytes2Seconds(oldStream, DecodeAhead::GetPosition(oldStream));
+            seconds        = seconds * VariantScale(channelEntry->variantSpeed) / VariantScale(variantSpeed);
+            DecodeAhead::SetPosition(newStream, BASS_ChannelSeconds2Bytes(newStream, seconds));
+            BASS_ChannelSetAttribute(newStream, BASS_ATTRIB_PAN, panning);
+
+            // The old stream must not fire the voice's loop or end events anymore
+            if (channelEntry->sync)
+                BASS_ChannelRemoveSync(DecodeAhead::Source(oldStream), channelEntry->sync);
+            channelEntry->basschan     = newStream;
+            channelEntry->tempoActive  = useTempo;
+            channelEntry->variantSpeed = variantSpeed;
+            if (variantSpeed)
+                strcpy_s(channelEntry->variantPath, variantPath);
+            SetVoiceSync(channel);
+
+            if (BASS_ChannelIsActive(oldStream) != BASS_ACTIVE_PLAYING) {
+                BASS_ChannelSetAttribute(newStream, BASS_ATTRIB_VOL, volume);
+                BASS_StreamFree(oldStream);
+                return;
+            }
+
+            BASS_ChannelSetAttribute(newStream, BASS_ATTRIB_VOL, 0.0f);
+            BASS_ChannelPlay(newStream, false);
+            BASS_ChannelSlideAttribute(newStream, BASS_ATTRIB_VOL, volume, TEMPO_CROSSFADE_MS);
+
+            // Fading to -1 stops the stream when the slide is done, AUTOFREE then releases it
+            BASS_ChannelFlags(oldStream, BASS_STREAM_AUTOFREE, BASS_STREAM_AUTOFREE);
+            BASS_ChannelSlideAttribute(oldStream, BASS_ATTRIB_VOL, -1.0f, TEMPO_CROSSFADE_MS);
+        }
+
+        void SetChannelSpeed(uint32 channel, float speed) {
+            if (channel >= CHANNEL_COUNT || !channels[channel].basschan)
+                return;
+
+            AudioChannel* channelEntry = &channels[channel];
+            channelEntry->appliedSpeed = speed;
+            bool isSFX = (channelEntry->state & 0x3F) == CHANNEL_SFX;
+            uint8 speedMode = isSFX ? Config::sfxSpeedMode : Config::musicSpeedMode;
+            // The other paths reopen the voice from sourcePath, which would drop the second deck
+            if (channelEntry->deck)
+                speedMode = Config::SPEED_RESAMPLE;
+
+            // Music uses a pre-rendered copy at this speed once there is one
+            float variantSpeed = 0.0f;
+            char variantPath[MAX_PATH];
+            if (speedMode == Config::SPEED_TEMPO && speed != 1.0f && !isSFX && Config::prerenderMusic) {
+                if (channelEntry->variantSpeed == speed)
+                    variantSpeed = speed;
+                else if (Prerender::Find(channelEntry->sourcePath, speed, MakeVoiceHandle(channel, channelEntry->generation.load()), variantPath,
+                                         sizeof(variantPath)) == Prerender::RENDER_READY)
+                    variantSpeed = speed;
+            }
+
+            bool useTempo = speedMode == Config::SPEED_TEMPO && speed != 1.0f && !variantSpeed;
+            if (useTempo != channelEntry->tempoActive || variantSpeed != channelEntry->variantSpeed)
+                SwitchVoicePath(channel, useTempo, variantSpeed, variantPath);
+
+            if (channelEntry->tempoActive) {
+                DecodeAhead::SetAttribute(channelEntry->basschan, BASS_ATTRIB_TEMPO, (speed - 1.0f) * 100.0f);
+            }
+            else {
+                // Plain resample, 0 puts the stream back at its own rate. A pre-rendered variant already runs at the speed
+                BASS_CHANNELINFO info;
+                if (speed == 1.0f || channelEntry->variantSpeed || !BASS_ChannelGetInfo(channelEntry->basschan, &info))
+                    BASS_ChannelSetAttribute(channelEntry->basschan, BASS_ATTRIB_FREQ, 0.0f);
+                else
+                    BASS_ChannelSetAttribute(channelEntry->basschan, BASS_ATTRIB_FREQ, info.freq * speed);
+            }
+        }
+
+        // Moves a voice still on the tempo processor over to its render, unless the voice or its speed has changed since
+        static void UsePrerender(VoiceHandle voice, float speed) {
+            uint32 channel = GetVoiceChannel(voice);
+            if (IsVoiceCurrent(voice) && channels[channel].appliedSpeed == speed && channels[channel].tempoActive)
+                SetChannelSpeed(channel, speed);
+        }
+
+        // Replaces a file image with the WAV vgmstream decodes it to
+        static bool DecodeWithVGMStream(const char* name, void** data, uint32* length) {
+            void* vgmstream = BASS_VGMSTREAM_InitVGMStreamFromMemory(*data, (int)*length, name);
+            if (!vgmstream)
+                return false;
+            int32 size = BASS_VGMSTREAM_GetVGMStreamOutputSize(vgmstream);
+            uint8* wav = size > 0 ? static_cast<uint8*>(malloc(size)) : nullptr;
+            bool converted = wav && BASS_VGMSTREAM_ConvertVGMStreamToWav(vgmstream, wav) >= 0;
+            BASS_VGMSTREAM_CloseVGMStream(vgmstream);
+            if (!converted) {
+                free(wav);
+                return false;
+            }
+
+            free(*data);
+            *data   = wav;
+            *length = (uint32)size;
+            return true;
+        }
+
+        enum StreamDecodeStates { STREAM_DECODE_PENDING, STREAM_DECODE_READY, STREAM_DECODE_FAILED };
+
+        struct DecodedStream {
+            // Path, size and write time, so a replaced file is decoded again
+            uint64 fileKey;
+            // PCMCache key, from the file's bytes
+            uint64 cacheKey;
+            uint8 state;
+            // Voices left CHANNEL_LOADING_STREAM until the decode is done
+            std::vector<VoiceHandle> waiting;
+        };
+
+        // Files BASS can't open are decoded by vgmstream on a thread of their own, never the audio thread
+        static WorkerPool streamDecoder;
+        static std::mutex decodedLock;
+        static std::unordered_map<std::string, DecodedStream> decodedStreams;
+
+        // Runs on the stream decode thread
+        static void DecodeStreamJob(const std::string& path, uint64 fileKey) {
+            void* data    = nullptr;
+            uint32 length = 0;
+            FILE* file;
+            fopen_s(&file, path.c_str(), "rb");
+            if (file) {
+                fseek(file, 0, SEEK_END);
+                data = malloc(length = ftell(file));
+                if (data) {
+                    fseek(file, 0, SEEK_SET);
+                    fread(data, 1, length, file);
+                }
+                fclose(file);
+            }
+
+            uint64 cacheKey = data ? PCMCache::MakeKey(Hash64(data, length), PCMCache::DECODER_VGMSTREAM, 0) : 0;
+            char cachedPath[MAX_PATH];
+            bool ready = data && PCMCache::Find(cacheKey, cachedPath, sizeof(cachedPath));
+            if (data && !ready) {
+                ready = DecodeWithVGMStream(path.c_str(), &data, &length) && PCMCache::Store(cacheKey, data, length);
+                printf(ready ? "[OriginsBASS] Decoded \"%s\" with vgmstream into the PCM cache\n" : "[OriginsBASS] Failed to decode \"%s\"\n", path.c_str());
+            }
+            free(data);
+
+            std::vector<VoiceHandle> waiting;
+            {
+                std::lock_guard<std::mutex> guard(decodedLock);
+                DecodedStream& entry = decodedStreams[path];
+                if (entry.fileKey == fileKey) {
+                    entry.cacheKey = cacheKey;
+                    entry.state    = ready ? STREAM_DECODE_READY : STREAM_DECODE_FAILED;
+                }
+                waiting.swap(entry.waiting);
+            }
+
+            // Voices that were stopped or replaced meanwhile are skipped by the audio thread
+            for (VoiceHandle voice : waiting) {
+                AudioCommand command{};
+                command.type    = AUDIOCMD_STREAM_DECODED;
+                command.voice   = voice;
+                command.channel = GetVoiceChannel(voice);
+                Submit(command);
+            }
+        }
+
+        // Gives the cached WAV of a file only vgmstream reads. The first time, the file is queued to be decoded
+        // and voice is told when it's ready
+        static uint8 FindDecodedStream(const char* path, VoiceHandle voice, char* out, uint32 outLen) {
+            WIN32_FILE_ATTRIBUTE_DATA attributes;
+            if (!PCMCache::Enabled() || !GetFileAttributesExA(path, GetFileExInfoStandard, &attributes))
+                return STREAM_DECODE_FAILED;
+            uint64 fileKey = HashString(path);
+            fileKey        = Hash64(&attributes.ftLastWriteTime, sizeof(attributes.ftLastWriteTime), fileKey);
+            fileKey        = Hash64(&attributes.nFileSizeLow, sizeof(attributes.nFileSizeLow), fileKey);
+
+            std::lock_guard<std::mutex> guard(decodedLock);
+            DecodedStream& entry = decodedStreams[path];
+            if (entry.fileKey == fileKey) {
+                if (entry.state == STREAM_DECODE_PENDING) {
+                    entry.waiting.push_back(voice);
+                    return STREAM_DECODE_PENDING;
+                }
+                if (entry.state == STREAM_DECODE_FAILED)
+                    return STREAM_DECODE_FAILED;
+                if (PCMCache::Find(entry.cacheKey, out, outLen))
+                    return STREAM_DECODE_READY;
+                // Evicted since, decode it again
+            }
+
+            entry.fileKey = fileKey;
+            entry.state   = STREAM_DECODE_PENDING;
+            entry.waiting.push_back(voice);
+            if (!streamDecoder.ThreadCount())
+                streamDecoder.Start(1);
+            std::string jobPath = path;
+            streamDecoder.Enqueue([jobPath, fileKey]() { DecodeStreamJob(jobPath, fileKey); });
+            return STREAM_DECODE_PENDING;
+        }
+
+        VoiceHandle LoadStream(uint32 channel, const char* filename, const char* name, int32 loopStart, int32 loopEnd) {
             if (channel >= CHANNEL_COUNT) {
                 printf("[OriginsBASS] Attempt to load channel out of bounds. channel = %u\n", channel);
-                return;
+                return VOICE_NONE;
             }
 
             if (channels[channel].basschan)
                 StopChannel(channel);
 
-            //channels[channel].basschan = BASS_VGMSTREAM_StreamCreate(filename, (loopStart ? BASS_SAMPLE_LOOP : 0) | BASS_STREAM_DECODE);
-            //if (!channels[channel].basschan)
-                channels[channel].basschan = BASS_StreamCreateFile(false, filename, 0, 0, (loopStart ? BASS_SAMPLE_LOOP : 0) | BASS_STREAM_DECODE);
+            AudioChannel* channelEntry = &channels[channel];
+            channelEntry->sourceBuffer = nullptr;
+            channelEntry->sourceLength = 0;
+            channelEntry->sourceLoops  = loopStart != 0;
+            strcpy_s(channelEntry->sourcePath, filename);
+
+            channels[channel].basschan = CreateVoiceStream(channelEntry, false);
+            if (!channels[channel].basschan) {
+                char decodedPath[MAX_PATH];
+                VoiceHandle pending = NextVoice(channel);
+                uint8 decodeState   = FindDecodedStream(filename, pending, decodedPath, sizeof(decodedPath));
+                if (decodeState == STREAM_DECODE_READY) {
+                    strcpy_s(channelEntry->sourcePath, decodedPath);
+                    channels[channel].basschan = CreateVoiceStream(channelEntry, false);
+                }
+                else if (decodeState == STREAM_DECODE_PENDING) {
+                    // The game sees the channel busy, StartDecodedStream picks it up once the decode is done
+                    printf("[OriginsBASS] Waiting for \"%s\" to be decoded in channel %u\n", filename, channel);
+                    strcpy_s(channelEntry->name, name);
+                    channelEntry->pendingStartPos  = 0;
+                    channelEntry->pendingLoopStart = loopStart;
+                    channelEntry->pendingLoopEnd   = loopEnd;
+                    channelEntry->state            = CHANNEL_LOADING_STREAM;
+                    return pending;
+                }
+            }
 
             if (channels[channel].basschan)
             {
                 printf("[OriginsBASS] Loaded file stream \"%s\" in channel %u\n", filename, channel);
                 channels[channel].state = CHANNEL_STREAM;
                 channels[channel].loopStart = BASS_ChannelSeconds2Bytes(channels[channel].basschan, loopStart / 44100.0);
-                channels[channel].loopEnd = BASS_ChannelSeconds2Bytes(channels[channel].basschan, loopEnd / 44100.0);
+                channels[channel].loopEnd = loopEnd == -1 ? -1 : BASS_ChannelSeconds2Bytes(channels[channel].basschan, loopEnd / 44100.0);
                 strcpy_s(channels[channel].name, name);
 
-                channels[channel].basschan = BASS_FX_TempoCreate(channels[channel].basschan, (loopStart ? BASS_SAMPLE_LOOP : 0));
-                if (loopStart)
-                    if (loopEnd == -1)
-                         BASS_ChannelSetSync(channels[channel].basschan, BASS_SYNC_END, 0, EventLoopTrack, reinterpret_cast<void*>((QWORD)channel));
-                     else
-                         BASS_ChannelSetSync(channels[channel].basschan, BASS_SYNC_POS, channels[channel].loopEnd, EventLoopTrack, reinterpret_cast<void*>((QWORD)channel));
-                 BASS_ChannelSetAttribute(channels[channel].basschan, BASS_ATTRIB_VOL, globalVolume);
+                VoiceHandle voice = NextVoice(channel);
+                SetVoiceSync(channel);
+                BASS_ChannelSetAttribute(channels[channel].basschan, BASS_ATTRIB_VOL, globalVolume);
+                return voice;
+            }
+            return VOICE_NONE;
+        }
+
+        // Starts a stream that was waiting for vgmstream, unless the channel has moved on since
+        static void StartDecodedStream(VoiceHandle voice) {
+            uint32 channel = GetVoiceChannel(voice);
+            AudioChannel* channelEntry = &channels[channel];
+            if (!IsVoiceCurrent(voice) || channelEntry->state != CHANNEL_LOADING_STREAM)
+                return;
+
+            char path[MAX_PATH];
+            char name[MAX_PATH];
+            strcpy_s(path, channelEntry->sourcePath);
+            strcpy_s(name, channelEntry->name);
+            uint32 startPos     = channelEntry->pendingStartPos;
+            channelEntry->state = CHANNEL_IDLE;
+            if (LoadStream(channel, path, name, channelEntry->pendingLoopStart, channelEntry->pendingLoopEnd)
+                && channelEntry->state == CHANNEL_STREAM)
+                PlayChannel(channel, startPos);
+        }
+
+        VoiceHandle LoadDeckStream(uint32 channel, const char* name, const char* altName, const DualDeck::DeckTrack& main, const DualDeck::DeckTrack& alt) {
+            if (channel >= CHANNEL_COUNT) {
+                printf("[OriginsBASS] Attempt to load channel out of bounds. channel = %u\n", channel);
+                return VOICE_NONE;
+            }
+
+            if (channels[channel].basschan)
+                StopChannel(channel);
+
+            AudioChannel* channelEntry = &channels[channel];
+            DualDeck::Deck* deck       = nullptr;
+            HSTREAM stream             = DualDeck::Create(main, alt, &channelEntry->positionStream, &deck);
+            if (!stream) {
+                printf("[OriginsBASS] Can't play \"%s\" and \"%s\" as a pair, loading a single stream\n", main.path, alt.path);
+                return LoadStream(channel, main.path, name, main.loopStart, main.loopEnd);
             }
+
+            printf("[OriginsBASS] Loaded file stream pair \"%s\" / \"%s\" in channel %u\n", main.path, alt.path, channel);
+            channelEntry->basschan     = stream;
+            channelEntry->deck         = deck;
+            channelEntry->sourceBuffer = nullptr;
+            channelEntry->sourceLength = 0;
+            // Loops are handled by the deck
+            channelEntry->sourceLoops  = false;
+            channelEntry->state        = CHANNEL_STREAM;
+            strcpy_s(channelEntry->sourcePath, main.path);
+            strcpy_s(channelEntry->name, name);
+            strcpy_s(channelEntry->altName, altName);
+
+            VoiceHandle voice = NextVoice(channel);
+            BASS_ChannelSetAttribute(stream, BASS_ATTRIB_VOL, globalVolume);
+            return voice;
+        }
+
+        bool SwitchDeck(uint32 channel, const char* name) {
+            if (channel >= CHANNEL_COUNT || !channels[channel].deck || strcmp(channels[channel].altName, name))
+                return false;
+            if (!DualDeck::Switch(channels[channel].deck))
+                return false;
+
+            AudioChannel* channelEntry = &channels[channel];
+            strcpy_s(channelEntry->altName, channelEntry->name);
+            strcpy_s(channelEntry->name, name);
+            return true;
         }
 
+        // Dual deck decoders output floats, so their positions go through time instead of bytes per sample
+        static uint32 GetDecoderSamples(DWORD decoder, QWORD bytes) {
+            BASS_CHANNELINFO info;
+            if (!BASS_ChannelGetInfo(decoder, &info))
+                return 0;
+            return (uint32)(BASS_ChannelBytes2Seconds(decoder, bytes) * info.freq);
+        }
+
+        // Also called from the game thread. BASS rejects a handle the audio thread has just freed,
+        // so at worst this reads the position of the previous stream
         uint32 GetChannelPos(uint32 channel) {
+            DWORD decoder = channels[channel].positionStream.load(std::memory_order_acquire);
+            if (decoder)
+                return GetDecoderSamples(decoder, BASS_ChannelGetPosition(decoder, BASS_POS_BYTE));
             if (channels[channel].basschan) {
                 BASS_CHANNELINFO info;
                 BASS_ChannelGetInfo(channels[channel].basschan, &info);
-                QWORD bytePos = BASS_ChannelGetPosition(channels[channel].basschan, BASS_POS_BYTE);
+                QWORD bytePos = DecodeAhead::GetPosition(channels[channel].basschan);
                 QWORD bps = (QWORD)(((info.origres ? (float)info.origres : 16.0f) / 8.0f) * (float)info.chans);
-                return (uint32)(bytePos / (float)bps);
+                return (uint32)(bytePos * VariantScale(channels[channel].variantSpeed) / (float)bps);
             }
             return 0;
         }
         
         uint32 GetChannelSampleCount(uint32 channel) {
+            DWORD decoder = channels[channel].positionStream.load(std::memory_order_acquire);
+            if (decoder)
+                return GetDecoderSamples(decoder, BASS_ChannelGetLength(decoder, BASS_POS_BYTE));
             if (channels[channel].basschan) {
                 BASS_CHANNELINFO info;
                 BASS_ChannelGetInfo(channels[channel].basschan, &info);
-                QWORD byteCount = BASS_ChannelGetLength(channels[channel].basschan, BASS_POS_BYTE);
+                QWORD byteCount = (QWORD)(BASS_ChannelGetLength(DecodeAhead::Source(channels[channel].basschan), BASS_POS_BYTE) * VariantScale(channels[channel].variantSpeed));
                 QWORD bps = (info.origres ? info.origres : 16) * info.chans;
                 return (byteCount / bps) & 0xFFFFFFFF;
             }
@@ -173,12 +1017,182 @@ namespace OriginsBASS {
 
         uint16 FindSFX(const char* name) {
             for (uint32 i = 0; i < SFX_COUNT; ++i) {
-                if (soundFXList[i].scope != SCOPE_NONE && !strcmp(name, soundFXList[i].name))
+                if (soundFXList[i].scope != SCOPE_NONE && soundFXList[i].loadState != SFX_FAILED && !strcmp(name, soundFXList[i].name))
                     return i;
             }
             return -1;
         }
 
+        static uint8 StorageFormat(uint8 scope) { return scope == SCOPE_STAGE ? Config::sfxStageStorage : Config::sfxGlobalStorage; }
+
+        // Runs on a loader thread
+        // Decodes a SFX file image into the given storage format, at the output rate. Files BASS can't open go through vgmstream.
+        // File images at that rate are kept as they are, resampled ones become 16-bit.
+        // Returns whether the buffer now holds decoded audio
+        static bool ConvertSFX(const char* name, uint8 format, SFXPool::Buffer* buffer) {
+            const DWORD decodeFlags = BASS_STREAM_DECODE | BASS_SAMPLE_FLOAT;
+            bool replaced   = false;
+            HSTREAM decoder = BASS_StreamCreateFile(true, buffer->data, 0, buffer->length, decodeFlags);
+            if (!decoder && DecodeWithVGMStream(name, &buffer->data, &buffer->length)) {
+                replaced        = true;
+                buffer->storage = Config::SFX_STORAGE_PCM16;
+                decoder         = BASS_StreamCreateFile(true, buffer->data, 0, buffer->length, decodeFlags);
+            }
+            BASS_CHANNELINFO info;
+            if (!decoder || !BASS_ChannelGetInfo(decoder, &info)
+                || (format == Config::SFX_STORAGE_FILE && info.freq == outputRate && !Config::sfxStorageBenchmark)) {
+                BASS_StreamFree(decoder);
+                return replaced;
+            }
+
+            std::vector<float> decoded;
+            float block[0x1000];
+            for (;;) {
+                DWORD got = BASS_ChannelGetData(decoder, block, sizeof(block) | BASS_DATA_FLOAT);
+                if (got == (DWORD)-1 || !got)
+                    break;
+                decoded.insert(decoded.end(), block, block + got / sizeof(float));
+            }
+            BASS_StreamFree(decoder);
+
+            std::vector<float> converted;
+            if (info.freq != outputRate)
+                Resampler::Convert(decoded.data(), (uint32)(decoded.size() / info.chans), info.chans, info.freq, outputRate, converted);
+            else
+                converted.swap(decoded);
+            uint32 frames = (uint32)(converted.size() / info.chans);
+
+            if (Config::sfxStorageBenchmark)
+                SFXStorage::Measure(converted.data(), frames, info.chans, outputRate);
+            if (format == Config::SFX_STORAGE_FILE) {
+                if (info.freq == outputRate)
+                    return replaced;
+                format = Config::SFX_STORAGE_PCM16;
+            }
+            if (format == Config::SFX_STORAGE_PCM16 && Config::sfxADPCMAboveKB && SFXStorage::PCM16Size(frames, info.chans) > Config::sfxADPCMAboveKB * 1024)
+                format = Config::SFX_STORAGE_ADPCM;
+
+            uint32 length = 0;
+            void* image   = SFXStorage::Store(converted.data(), frames, info.chans, outputRate, format, &length);
+            if (!image)
+                return replaced;
+
+            free(buffer->data);
+            buffer->data    = image;
+            buffer->length  = length;
+            buffer->storage = format;
+            return true;
+        }
+
+        // Runs on a loader thread once the queued reads are done
+        static void PrintSFXMemory() {
+            const char* scopeNames[] = { "none", "global", "stage" };
+            std::vector<std::pair<const void*, uint32>> buffers;
+            uint64 slotBytes = 0;
+            for (uint8 scope = SCOPE_GLOBAL; scope <= SCOPE_STAGE; ++scope) {
+                uint32 count = 0;
+                uint64 bytes[3] = {};
+                for (uint32 i = 0; i < SFX_COUNT; ++i) {
+                    SoundFX* sfx = &soundFXList[i];
+                    if (sfx->scope != scope || sfx->loadState.load(std::memory_order_acquire) != SFX_READY || sfx->storage > Config::SFX_STORAGE_ADPCM)
+                        continue;
+                    ++count;
+                    bytes[sfx->storage] += sfx->bufferLength;
+                    buffers.emplace_back(sfx->buffer, sfx->bufferLength);
+                }
+                slotBytes += bytes[0] + bytes[1] + bytes[2];
+                if (count)
+                    printf("[OriginsBASS] SFX memory, %s scope: %u sounds, %llu KB (file %llu KB, 16-bit %llu KB, ADPCM %llu KB)\n", scopeNames[scope], count,
+                           (bytes[0] + bytes[1] + bytes[2]) / 1024, bytes[0] / 1024, bytes[1] / 1024, bytes[2] / 1024);
+            }
+
+            // Slots loaded from the same content point at one buffer
+            std::sort(buffers.begin(), buffers.end());
+            buffers.erase(std::unique(buffers.begin(), buffers.end()), buffers.end());
+            uint64 heldBytes = 0;
+            for (auto& buffer : buffers)
+                heldBytes += buffer.second;
+            if (slotBytes != heldBytes)
+                printf("[OriginsBASS] SFX dedup: %zu buffers held, %llu KB, saved %llu KB\n", buffers.size(), heldBytes / 1024, (slotBytes - heldBytes) / 1024);
+
+            SFXStorage::PrintStats();
+        }
+
+        static void ReadSFXFile(uint16 slot, const std::string& filePath) {
+            SoundFX* sfx = &soundFXList[slot];
+            uint8 state = SFX_FAILED;
+
+            SFXPool::Buffer buffer{ nullptr, 0, Config::SFX_STORAGE_FILE, false };
+            FILE* file;
+            fopen_s(&file, filePath.c_str(), "rb");
+            if (file) {
+                fseek(file, 0, SEEK_END);
+                long size   = ftell(file);
+                buffer.data = size > 0 ? malloc(buffer.length = (uint32)size) : nullptr;
+                if (buffer.data) {
+                    fseek(file, 0, SEEK_SET);
+                    if (fread(buffer.data, 1, buffer.length, file) == buffer.length) {
+                        state = SFX_READY;
+                    }
+                    else {
+                        free(buffer.data);
+                        buffer.data = nullptr;
+                    }
+                }
+                fclose(file);
+            }
+
+            if (state == SFX_FAILED) {
+                printf("[OriginsBASS] Failed to read SFX \"%s\"\n", filePath.c_str());
+            }
+            else {
+                // Identical files share one buffer as long as they're stored the same way
+                uint8 format = StorageFormat(sfx->scope);
+                uint64 key   = Hash64(buffer.data, buffer.length, format);
+                SFXPool::Buffer shared;
+                // Decoded output from an earlier launch is mapped straight from the cache
+                uint64 cacheKey = PCMCache::MakeKey(key, PCMCache::DECODER_SFX, ((uint64)Config::sfxADPCMAboveKB << 32) | outputRate);
+                const void* cached;
+                uint32 cachedLength;
+                if (SFXPool::Find(key, buffer.data, buffer.length, &shared)) {
+                    free(buffer.data);
+                    buffer = shared;
+                }
+                else if (PCMCache::Enabled() && (cached = PCMCache::Open(cacheKey, &cachedLength))) {
+                    SFXPool::Buffer file = buffer;
+                    buffer = SFXPool::Add(key, { const_cast<void*>(cached), cachedLength, SFXStorage::FormatOf(cached, cachedLength), true }, file.data, file.length);
+                    free(file.data);
+                }
+                else {
+                    // Converting frees the file image, the pool still needs it to tell files with the same hash apart
+                    std::vector<uint8> file(static_cast<uint8*>(buffer.data), static_cast<uint8*>(buffer.data) + buffer.length);
+                    bool converted = outputRate && ConvertSFX(filePath.c_str(), format, &buffer);
+                    if (converted && PCMCache::Enabled())
+                        PCMCache::Store(cacheKey, buffer.data, buffer.length);
+                    buffer = SFXPool::Add(key, buffer, converted ? file.data() : buffer.data, (uint32)file.size());
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> guard(sfxLoadLock);
+                if (state == SFX_READY) {
+                    sfx->buffer       = buffer.data;
+                    sfx->bufferLength = buffer.length;
+                    sfx->storage      = buffer.storage;
+                }
+                // A sound that couldn't be read gives its slot back, like LoadSFX did before reads were threaded
+                if (state == SFX_FAILED) {
+                    sfx->scope   = SCOPE_NONE;
+                    sfx->name[0] = '\0';
+                }
+                sfx->loadState.store(state, std::memory_order_release);
+            }
+            sfxLoadSignal.notify_all();
+
+            if (sfxPending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                PrintSFXMemory();
+        }
+
         uint16 LoadSFX(const char *filePath, const char *name, uint8 slot, uint8 maxConcurrentPlays, uint8 scope) {
             if (slot == 0xFF) {
                 for (uint32 i = 0; i < SFX_COUNT; ++i) {
@@ -196,35 +1210,54 @@ namespace OriginsBASS {
 
             SoundFX* sfx = &soundFXList[slot];
 
-            if (sfx->buffer)
-                free(sfx->buffer);
+            // Don't free a buffer a loader thread is still filling
+            WaitForSFX(slot);
 
-            strcpy_s(sfx->name, name);
+            {
+                // PlaySfx takes its reference under this lock, so the buffer can't go while it does
+                std::lock_guard<std::mutex> guard(sfxLoadLock);
+                // Voices still playing the old sound keep their own reference
+                if (sfx->buffer) {
+                    SFXPool::Release(sfx->buffer);
+                    sfx->buffer = nullptr;
+                }
 
-            FILE* file;
-            fopen_s(&file, filePath, "rb");
-            if (file) {
-                fseek(file, 0, SEEK_END);
-                sfx->buffer = malloc(sfx->bufferLength = ftell(file));
-                if (!sfx->buffer)
-                    return -1;
-                fseek(file, 0, SEEK_SET);
-                fread(sfx->buffer, 1, sfx->bufferLength, file);
-                fclose(file);
+                // Reserve the slot now, the file is read in the background
+                strcpy_s(sfx->name, name);
                 sfx->scope = scope;
                 sfx->maxConcurrentPlays = maxConcurrentPlays;
+                sfx->storage = Config::SFX_STORAGE_FILE;
+                sfx->loadState.store(SFX_LOADING, std::memory_order_relaxed);
             }
 
+            std::string path = filePath;
+            sfxPending.fetch_add(1, std::memory_order_relaxed);
+            sfxLoader.Enqueue([slot, path]() { ReadSFXFile(slot, path); });
+
             return slot;
         }
 
-        void PlaySfx(uint16 sfx, uint32 loopPoint, uint32 priority)
+        bool WaitForSFX(uint16 sfx) {
+            SoundFX* sfxEntry = &soundFXList[sfx];
+            if (sfxEntry->loadState.load(std::memory_order_acquire) == SFX_LOADING) {
+                std::unique_lock<std::mutex> guard(sfxLoadLock);
+                sfxLoadSignal.wait(guard, [sfxEntry] { return sfxEntry->loadState.load(std::memory_order_acquire) != SFX_LOADING; });
+            }
+            return sfxEntry->loadState.load(std::memory_order_acquire) == SFX_READY;
+        }
+
+        VoiceHandle PlaySfx(uint16 sfx, uint32 loopPoint, uint32 priority, int64 issued)
         {
             if (sfx >= SFX_COUNT || !soundFXList[sfx].scope)
-                return;
+                return VOICE_NONE;
 
             SoundFX* sfxEntry = &soundFXList[sfx];
 
+            // QueuePlaySfx already waited out the load that was in flight. One seen here started after the play was queued,
+            // and this can be the audio thread, so it isn't waited on
+            if (sfxEntry->loadState.load(std::memory_order_acquire) != SFX_READY)
+                return VOICE_NONE;
+
             uint8 firstChannel = 0;
             uint8 count = 0;
             for (int32 c = CHANNEL_COUNT - 1; c > 0; --c) {
@@ -236,30 +1269,47 @@ namespace OriginsBASS {
 
             if (count >= sfxEntry->maxConcurrentPlays) {
                 StopChannel(firstChannel);
-                return;
+                return VOICE_NONE;
             }
 
             int8 channel = FindBestChannel();
 
             if (channel == -1)
-                return;
+                return VOICE_NONE;
 
             AudioChannel *chan = &channels[channel];
 
             if (chan->basschan)
                 StopChannel(channel);
 
-            chan->basschan = BASS_StreamCreateFile(true, sfxEntry->buffer, 0, sfxEntry->bufferLength, BASS_STREAM_DECODE);
+            // The slot can be reloaded on the game thread at any time. The reference taken here keeps the buffer
+            // alive until the stream holds its own
+            SFXPool::Buffer buffer;
+            {
+                std::lock_guard<std::mutex> guard(sfxLoadLock);
+                if (sfxEntry->loadState.load(std::memory_order_relaxed) != SFX_READY || !SFXPool::Acquire(sfxEntry->buffer, &buffer))
+                    return VOICE_NONE;
+            }
+
+            chan->sourceBuffer  = buffer.data;
+            chan->sourceLength  = buffer.length;
+            chan->sourceLoops   = false;
+            chan->sourcePath[0] = '\0';
+            chan->basschan      = CreateVoiceStream(chan, false);
+            SFXPool::Release(buffer.data);
 
             if (chan->basschan)
             {
-                channels[channel].basschan = BASS_FX_TempoCreate(channels[channel].basschan, BASS_FX_FREESOURCE);
-                BASS_ChannelSetSync(channels[channel].basschan, BASS_SYNC_END | BASS_SYNC_MIXTIME, 0, EventClearSFX, reinterpret_cast<void*>(channel));
+                VoiceHandle voice = NextVoice(channel);
+                SetVoiceSync(channel);
                 BASS_ChannelSetAttribute(channels[channel].basschan, BASS_ATTRIB_VOL, globalVolume);
                 channels[channel].state = CHANNEL_SFX;
                 channels[channel].soundID = sfx;
+                Latency::Track(channels[channel].basschan, issued);
                 BASS_ChannelPlay(channels[channel].basschan, true);
+                return voice;
             }
+            return VOICE_NONE;
         }
     }// namespace Audio
 } // namespace OriginsBASS
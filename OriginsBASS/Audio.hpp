@@ -1,26 +1,109 @@
+#include "DualDeck.hpp"
+
 namespace OriginsBASS {
+    // Implemented in mod.cpp, handles a PlayStream call on the audio thread
+    void StartStream(const char* filename, uint32 channel, uint32 startPos, uint32 loopPoint);
+
     namespace Audio {
 
         enum ChannelStates { CHANNEL_IDLE, CHANNEL_SFX, CHANNEL_STREAM, CHANNEL_LOADING_STREAM, CHANNEL_PAUSED = 0x40 };
+        enum SFXLoadStates { SFX_UNLOADED, SFX_LOADING, SFX_READY, SFX_FAILED };
+        enum AudioCommands {
+            AUDIOCMD_PLAY_SFX,
+            AUDIOCMD_PLAY_STREAM,
+            AUDIOCMD_STOP_CHANNEL,
+            AUDIOCMD_PAUSE_CHANNEL,
+            AUDIOCMD_RESUME_CHANNEL,
+            AUDIOCMD_SET_ATTRIBUTES,
+            AUDIOCMD_RESET_CHANNELS,
+            AUDIOCMD_UPDATE,
+            AUDIOCMD_STREAM_DECODED,
+            AUDIOCMD_PRERENDERED,
+        };
         
+        // A voice handle packs a channel index with the generation the channel was on when the voice
+        // started. Every stream a channel gets bumps its generation, so a handle or sync callback left
+        // over from an earlier stream no longer matches and is ignored
+        typedef uint32 VoiceHandle;
+        const VoiceHandle VOICE_NONE      = 0;
+        const uint32 VOICE_CHANNEL_BITS   = 4;
+        const uint32 VOICE_GENERATION_MAX = 0xFFFFFFFF >> VOICE_CHANNEL_BITS;
+        static_assert(CHANNEL_COUNT <= (1 << VOICE_CHANNEL_BITS), "Channel index doesn't fit in a voice handle");
+
+        inline VoiceHandle MakeVoiceHandle(uint32 channel, uint32 generation) { return (generation << VOICE_CHANNEL_BITS) | channel; }
+        inline uint32 GetVoiceChannel(VoiceHandle voice) { return voice & ((1 << VOICE_CHANNEL_BITS) - 1); }
+        inline uint32 GetVoiceGeneration(VoiceHandle voice) { return voice >> VOICE_CHANNEL_BITS; }
+
         struct SoundFX {
 		    char name[MAX_PATH];
             void* buffer;
             uint32 bufferLength;
+            // A Config::SFXStorageFormats format
+            uint8 storage;
             uint8 scope;
             uint8 maxConcurrentPlays;
+            std::atomic<uint8> loadState;
 	    };
 
         struct AudioChannel {
 		    DWORD basschan;
             int32 loopStart;
             int32 loopEnd;
-            uint8 state;
+            std::atomic<uint8> state;
+            std::atomic<uint32> generation;
             int16 soundID;
 		    char name[MAX_PATH];
 		    float streamSpeed;
+            // Speed SetChannelSpeed last put the voice at
+            float appliedSpeed;
+
+            // Where the voice's audio comes from, so it can be reopened with or without the tempo processor
+            const void* sourceBuffer;
+            uint32 sourceLength;
+            char sourcePath[MAX_PATH];
+            bool sourceLoops;
+            bool tempoActive;
+            HSYNC sync;
+
+            // Speed baked into the pre-rendered file the voice is playing, 0 while it plays the source.
+            // Loop points and positions stay in source bytes and are scaled by this
+            float variantSpeed;
+            char variantPath[MAX_PATH];
+
+            // Set when the voice plays a normal/fast pair through DualDeck. altName is the track not being heard,
+            // positionStream the decoder that is, so positions can be read from the game thread
+            DualDeck::Deck* deck;
+            char altName[MAX_PATH];
+            std::atomic<DWORD> positionStream;
+
+            // While the channel is CHANNEL_LOADING_STREAM, what the stream starts with once its decode is ready
+            uint32 pendingStartPos;
+            int32 pendingLoopStart;
+            int32 pendingLoopEnd;
+
+            // Commands posted for this channel that the audio thread hasn't run yet,
+            // and the state they will leave it in
+            std::atomic<uint32> pendingCommands;
+            std::atomic<uint8> requestedState;
 	    };
 
+        struct AudioCommand {
+            uint8 type;
+            bool predicted;
+            uint16 sfx;
+            uint32 channel;
+            VoiceHandle voice;
+            uint32 startPos;
+            uint32 loopPoint;
+            uint32 priority;
+            float volume;
+            float panning;
+            float speed;
+            // When the game asked for it, only set while measuring latency
+            int64 issued;
+            char filename[MAX_PATH];
+        };
+
 
         extern SoundFX soundFXList[SFX_COUNT];
         extern AudioChannel channels[CHANNEL_COUNT];
@@ -29,18 +112,41 @@ namespace OriginsBASS {
         // Event
         static void __stdcall EventLoopTrack(HSYNC handle, DWORD channel, DWORD data, void* user);
 
+        void InitLoader(uint32 threadCount);
+        void StartCommandThread();
         void ResetChannels();
         void StopChannel(uint32 channel);
         void PauseChannel(uint32 channel);
         void ResumeChannel(uint32 channel);
         void PlayChannel(uint32 channel, uint32 startPos);
         void SetChannelAttributes(uint32 channel, float volume, float panning, float speed);
-        void LoadStream(uint32 channel, const char* filename, const char* name, int32 loopStart, int32 loopEnd);
+        void SetChannelSpeed(uint32 channel, float speed);
+        VoiceHandle LoadStream(uint32 channel, const char* filename, const char* name, int32 loopStart, int32 loopEnd);
+        VoiceHandle LoadDeckStream(uint32 channel, const char* name, const char* altName, const DualDeck::DeckTrack& main, const DualDeck::DeckTrack& alt);
+        bool SwitchDeck(uint32 channel, const char* name);
+        // Picks a music voice that was stopped or replaced back up where it was paused
+        bool ResumeSuspended(uint32 channel, const char* name);
         uint32 GetChannelPos(uint32 channel);
         uint32 GetChannelSampleCount(uint32 channel);
         uint8 FindBestChannel();
         uint16 FindSFX(const char* name);
         uint16 LoadSFX(const char* filePath, const char* name, uint8 slot, uint8 maxConcurrentPlays, uint8 scope);
-        void PlaySfx(uint16 sfx, uint32 loopPoint, uint32 priority);
+        bool WaitForSFX(uint16 sfx);
+        VoiceHandle PlaySfx(uint16 sfx, uint32 loopPoint, uint32 priority, int64 issued = 0);
+        bool IsVoiceCurrent(VoiceHandle voice);
+
+        // Called from the game thread. These post to the audio thread when it is running,
+        // otherwise they run immediately
+        uint8 GetChannelState(uint32 channel);
+        void QueuePlaySfx(uint16 sfx, uint32 loopPoint, uint32 priority);
+        // fileFound is false when there's no file to load, then only a speed change or deck switch on what is
+        // already playing can come of it and the channel isn't predicted to start a stream
+        void QueuePlayStream(const char* filename, uint32 channel, uint32 startPos, uint32 loopPoint, bool fileFound);
+        void QueueStopChannel(uint32 channel);
+        void QueuePauseChannel(uint32 channel);
+        void QueueResumeChannel(uint32 channel);
+        void QueueSetChannelAttributes(uint32 channel, float volume, float panning, float speed);
+        void QueueResetChannels();
+        void QueueUpdate();
     }// namespace Audio
 } // namespace OriginsBASS
@@ -0,0 +1,134 @@
+#include "pch.h"
+#include "BufferMonitor.hpp"
+#include "DecodeAhead.hpp"
+
+namespace OriginsBASS {
+    namespace BufferMonitor {
+
+        const ULONGLONG UPDATE_INTERVAL_MS = 100;
+        // A voice holding less than this share of its buffer counts as an underrun
+        const float UNDERRUN_FILL = 0.1f;
+        // Samples without any underrun before the buffer is shrunk
+        const uint32 SHRINK_SAMPLES = 300;
+        const float GROW_FACTOR     = 1.5f;
+        const float SHRINK_FACTOR   = 0.8f;
+        const uint32 UPDATE_PERIOD_MIN = 5;
+        const uint32 UPDATE_PERIOD_MAX = 100;
+
+        static uint32 minBuffer           = 0;
+        static uint32 maxBuffer           = 0;
+        static uint32 deviceLatency       = 0;
+        static ULONGLONG lastUpdate       = 0;
+        static uint32 calmStreak          = 0;
+        static uint32 lastDecodeUnderruns = 0;
+        // The update period keeps the share of the buffer it had at the start, 100 / 500 with BASS's defaults
+        static float periodRatio          = 0.2f;
+
+        static std::atomic<uint32> currentBuffer{ 0 };
+        static std::atomic<uint32> currentPeriod{ 0 };
+        static std::atomic<uint32> underruns{ 0 };
+        static std::atomic<uint32> adjustments{ 0 };
+
+        // The buffer length only applies to streams created afterwards, the update period right away
+        static void SetBuffer(uint32 bufferMs) {
+            uint32 period = (std::min)((std::max)((uint32)(bufferMs * periodRatio), UPDATE_PERIOD_MIN), UPDATE_PERIOD_MAX);
+            BASS_SetConfig(BASS_CONFIG_UPDATEPERIOD, period);
+            BASS_SetConfig(BASS_CONFIG_BUFFER, bufferMs);
+            currentBuffer.store(bufferMs, std::memory_order_relaxed);
+            currentPeriod.store(period, std::memory_order_relaxed);
+        }
+
+        void Init(uint32 minMs, uint32 maxMs) {
+            if (!minMs)
+                return;
+
+            BASS_INFO info;
+            if (BASS_GetInfo(&info))
+                deviceLatency = info.latency;
+
+            // A latency profile that starts below the minimum lowers it, the monitor only grows from there if it has to
+            uint32 start = (std::min)((uint32)BASS_GetConfig(BASS_CONFIG_BUFFER), maxMs);
+            minBuffer    = (std::min)(minMs, start);
+            maxBuffer    = (std::max)(minBuffer, maxMs);
+            periodRatio  = (float)BASS_GetConfig(BASS_CONFIG_UPDATEPERIOD) / (std::max)(start, 1u);
+            SetBuffer(start);
+            printf("[OriginsBASS] Playback buffer %u ms, update period %u ms, device latency %u ms\n", start,
+                   currentPeriod.load(std::memory_order_relaxed), deviceLatency);
+        }
+
+        void Update() {
+            if (!minBuffer)
+                return;
+
+            ULONGLONG now = GetTickCount64();
+            if (now - lastUpdate < UPDATE_INTERVAL_MS)
+                return;
+            lastUpdate = now;
+
+            uint32 bufferMs = currentBuffer.load(std::memory_order_relaxed);
+            uint32 starved  = 0;
+            for (int i = 0; i < CHANNEL_COUNT; ++i) {
+                DWORD stream = Audio::channels[i].basschan;
+                if (!stream)
+                    continue;
+
+                // Stalled means the stream itself had nothing to give, which the buffer can't fix but is still a gap
+                DWORD active = BASS_ChannelIsActive(stream);
+                if (active == BASS_ACTIVE_STALLED) {
+                    ++starved;
+                    continue;
+                }
+                if (active != BASS_ACTIVE_PLAYING)
+                    continue;
+
+                DWORD available = BASS_ChannelGetData(stream, nullptr, BASS_DATA_AVAILABLE);
+                if (available == (DWORD)-1)
+                    continue;
+                // A voice running out at the end of its file isn't starving. Decode-ahead and deck streams have no length
+                // of their own, so the decoder's is used, and a stream with no known length is never near its end
+                DWORD source    = DecodeAhead::Source(stream);
+                QWORD length    = BASS_ChannelGetLength(source, BASS_POS_BYTE);
+                QWORD remaining = length == (QWORD)-1 ? (QWORD)-1 : length - (std::min)(length, BASS_ChannelGetPosition(source, BASS_POS_BYTE));
+                double filled   = BASS_ChannelBytes2Seconds(stream, available) * 1000.0;
+                if (filled < bufferMs * UNDERRUN_FILL && remaining > available)
+                    ++starved;
+            }
+
+            uint32 decodeUnderruns = DecodeAhead::UnderrunCount();
+            uint32 decodeStarved   = decodeUnderruns - lastDecodeUnderruns;
+            lastDecodeUnderruns    = decodeUnderruns;
+            underruns.fetch_add(starved, std::memory_order_relaxed);
+
+            if (starved || decodeStarved) {
+                calmStreak = 0;
+                if (bufferMs < maxBuffer) {
+                    uint32 grown = (std::min)((uint32)(bufferMs * GROW_FACTOR), maxBuffer);
+                    SetBuffer(grown);
+                    adjustments.fetch_add(1, std::memory_order_relaxed);
+                    printf("[OriginsBASS] %u underrun(s), playback buffer %u -> %u ms\n", starved + decodeStarved, bufferMs, grown);
+                }
+                return;
+            }
+
+            if (++calmStreak >= SHRINK_SAMPLES && bufferMs > minBuffer) {
+                calmStreak    = 0;
+                uint32 shrunk = (std::max)((uint32)(bufferMs * SHRINK_FACTOR), minBuffer);
+                SetBuffer(shrunk);
+                adjustments.fetch_add(1, std::memory_order_relaxed);
+                printf("[OriginsBASS] No underruns for a while, playback buffer %u -> %u ms\n", bufferMs, shrunk);
+            }
+        }
+
+        Telemetry GetTelemetry() {
+            Telemetry telemetry;
+            telemetry.bufferMs        = currentBuffer.load(std::memory_order_relaxed);
+            telemetry.updatePeriodMs  = currentPeriod.load(std::memory_order_relaxed);
+            telemetry.latencyMs       = deviceLatency + telemetry.bufferMs;
+            telemetry.underruns       = underruns.load(std::memory_order_relaxed);
+            telemetry.decodeUnderruns = DecodeAhead::UnderrunCount();
+            telemetry.adjustments     = adjustments.load(std::memory_order_relaxed);
+            return telemetry;
+        }
+
+    } // namespace BufferMonitor
+} // namespace OriginsBASS
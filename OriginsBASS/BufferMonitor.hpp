@@ -0,0 +1,29 @@
+#pragma once
+
+namespace OriginsBASS {
+
+    // Watches how full the playback buffers of playing voices are and counts underruns.
+    // Underruns grow the playback buffer and update period, a long run without any shrinks them again,
+    // always within [Audio] BufferMinMS and BufferMaxMS.
+    namespace BufferMonitor {
+
+        struct Telemetry {
+            uint32 bufferMs;
+            uint32 updatePeriodMs;
+            // Device latency reported by BASS plus the playback buffer
+            uint32 latencyMs;
+            // Voices that were nearly out of data when sampled, and music decode-ahead rings that ran dry
+            uint32 underruns;
+            uint32 decodeUnderruns;
+            uint32 adjustments;
+        };
+
+        // Starts from the buffer the latency profile set. A minimum of 0 leaves BASS alone and turns the monitor off
+        void Init(uint32 minMs, uint32 maxMs);
+        // Samples the buffers and resizes them if needed. Call from the thread that owns the channels
+        void Update();
+        // Safe from any thread
+        Telemetry GetTelemetry();
+
+    } // namespace BufferMonitor
+} // namespace OriginsBASS
@@ -0,0 +1,166 @@
+#include "pch.h"
+#include "IniView.hpp"
+#include "Config.hpp"
+#include "TempoQuality.hpp"
+
+namespace OriginsBASS {
+    namespace Config {
+
+        char modDirectory[MAX_PATH];
+
+        bool audioCommandThread = true;
+        uint8 sfxSpeedMode      = SPEED_RESAMPLE;
+        uint8 musicSpeedMode    = SPEED_TEMPO;
+        int32 tempoQuality      = TempoQuality::TEMPO_QUALITY_AUTO;
+        bool prerenderMusic     = true;
+        bool dualDeck           = true;
+        uint32 warmDecoders     = 4;
+        uint32 musicCacheMB     = 64;
+        uint32 pcmCacheMB       = 256;
+        uint32 suspendDepth     = 2;
+        uint32 decodeAheadMS    = 1000;
+        uint32 bufferMinMS      = 150;
+        uint32 bufferMaxMS      = 1000;
+        LatencyProfile latencyProfile = { "Default", 0, 0, 0, 0 };
+        bool measureLatency     = false;
+        bool headless           = false;
+
+        uint32 sfxLoadThreads = 0;
+        uint8 sfxNotReadyPolicy = SFX_NOTREADY_WAIT;
+        uint8 sfxGlobalStorage = SFX_STORAGE_FILE;
+        uint8 sfxStageStorage = SFX_STORAGE_FILE;
+        uint32 sfxADPCMAboveKB = 0;
+        bool sfxStorageBenchmark = false;
+
+        uint32 sigScanThreads = 1;
+
+        static bool FindModDirectory() {
+            HMODULE module = nullptr;
+            if (!GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                                    reinterpret_cast<LPCSTR>(&Load), &module))
+                return false;
+
+            if (!GetModuleFileNameA(module, modDirectory, sizeof(modDirectory)))
+                return false;
+
+            char* slash = strrchr(modDirectory, '\\');
+            if (slash)
+                *slash = '\0';
+            return true;
+        }
+
+        // Built in profiles. Default keeps whatever BASS picks
+        static const LatencyProfile latencyProfiles[] = {
+            { "Default", 0, 0, 0, 0 },
+            { "Balanced", 40, 20, 1, 200 },
+            { "Low", 20, 10, 1, 100 },
+            { "Minimum", 10, 5, 2, 60 },
+        };
+
+        // A [LatencyProfile.<name>] section overrides a built in profile, or defines a new one starting from Default
+        static void ReadLatencyProfile(const IniView& ini) {
+            std::string name(ini.getString("Audio", "LatencyProfile", "Default"));
+            bool found       = false;
+            for (const LatencyProfile& profile : latencyProfiles) {
+                if (!_stricmp(profile.name, name.c_str())) {
+                    latencyProfile = profile;
+                    found          = true;
+                }
+            }
+            strcpy_s(latencyProfile.name, name.c_str());
+
+            std::string section = "LatencyProfile." + name;
+            if (!found && ini.getString(section, "DeviceBufferMS").empty() && ini.getString(section, "UpdatePeriodMS").empty()
+                && ini.getString(section, "UpdateThreads").empty() && ini.getString(section, "BufferMS").empty()) {
+                printf("[OriginsBASS] Unknown latency profile \"%s\", using Default\n", name.c_str());
+                latencyProfile = latencyProfiles[0];
+                return;
+            }
+
+            latencyProfile.deviceBufferMs = ini.getInt(section, "DeviceBufferMS", latencyProfile.deviceBufferMs);
+            latencyProfile.updatePeriodMs = ini.getInt(section, "UpdatePeriodMS", latencyProfile.updatePeriodMs);
+            latencyProfile.updateThreads  = ini.getInt(section, "UpdateThreads", latencyProfile.updateThreads);
+            latencyProfile.bufferMs       = ini.getInt(section, "BufferMS", latencyProfile.bufferMs);
+        }
+
+        static uint8 ReadSFXStorage(const IniView& ini, const char* name, uint8 defaultFormat) {
+            std::string format(ini.getString("SFX", name));
+            if (!_stricmp(format.c_str(), "File"))
+                return SFX_STORAGE_FILE;
+            if (!_stricmp(format.c_str(), "PCM16"))
+                return SFX_STORAGE_PCM16;
+            if (!_stricmp(format.c_str(), "ADPCM"))
+                return SFX_STORAGE_ADPCM;
+            return defaultFormat;
+        }
+
+        static uint8 ReadSpeedMode(const IniView& ini, const char* name, uint8 defaultMode) {
+            std::string mode(ini.getString("Audio", name));
+            if (!_stricmp(mode.c_str(), "Resample"))
+                return SPEED_RESAMPLE;
+            if (!_stricmp(mode.c_str(), "Tempo"))
+                return SPEED_TEMPO;
+            return defaultMode;
+        }
+
+        void Load() {
+            if (!FindModDirectory())
+                return;
+
+            // Settings live in the mod.ini next to our DLL
+            char iniPath[MAX_PATH];
+            sprintf_s(iniPath, "%s\\mod.ini", modDirectory);
+            if (GetFileAttributesA(iniPath) == INVALID_FILE_ATTRIBUTES)
+                return;
+
+            IniView ini(iniPath);
+            if (!ini.isOpen()) {
+                printf("[OriginsBASS] INI parse error: \"%s\"\n", iniPath);
+                return;
+            }
+
+            audioCommandThread = ini.getBool("Audio", "CommandThread", audioCommandThread);
+            sfxSpeedMode       = ReadSpeedMode(ini, "SFXSpeedMode", sfxSpeedMode);
+            musicSpeedMode     = ReadSpeedMode(ini, "MusicSpeedMode", musicSpeedMode);
+            tempoQuality       = TempoQuality::ParseTier(std::string(ini.getString("Audio", "TempoQuality", "Auto")).c_str());
+            prerenderMusic     = ini.getBool("Audio", "PrerenderMusic", prerenderMusic);
+            dualDeck           = ini.getBool("Audio", "DualDeck", dualDeck);
+            warmDecoders       = ini.getInt("Audio", "WarmDecoders", warmDecoders);
+            musicCacheMB       = ini.getInt("Audio", "MusicCacheMB", musicCacheMB);
+            pcmCacheMB         = ini.getInt("Audio", "PCMCacheMB", pcmCacheMB);
+            suspendDepth       = ini.getInt("Audio", "SuspendDepth", suspendDepth);
+            decodeAheadMS      = ini.getInt("Audio", "DecodeAheadMS", decodeAheadMS);
+            bufferMinMS        = ini.getInt("Audio", "BufferMinMS", bufferMinMS);
+            bufferMaxMS        = ini.getInt("Audio", "BufferMaxMS", bufferMaxMS);
+            measureLatency     = ini.getBool("Audio", "MeasureLatency", measureLatency);
+            headless           = ini.getBool("Audio", "Headless", headless);
+            ReadLatencyProfile(ini);
+
+            sfxLoadThreads = ini.getInt("SFX", "LoadThreads", sfxLoadThreads);
+            std::string policy(ini.getString("SFX", "NotReadyPolicy", "Wait"));
+            sfxNotReadyPolicy = !_stricmp(policy.c_str(), "Drop") ? SFX_NOTREADY_DROP : SFX_NOTREADY_WAIT;
+            sfxGlobalStorage = ReadSFXStorage(ini, "GlobalStorage", sfxGlobalStorage);
+            sfxStageStorage = ReadSFXStorage(ini, "StageStorage", sfxStageStorage);
+            sfxADPCMAboveKB = ini.getInt("SFX", "ADPCMAboveKB", sfxADPCMAboveKB);
+            sfxStorageBenchmark = ini.getBool("SFX", "StorageBenchmark", sfxStorageBenchmark);
+
+            sigScanThreads = ini.getInt("SigScan", "Threads", sigScanThreads);
+
+            printf("[OriginsBASS] Loaded config from %s\n", iniPath);
+        }
+
+        // Caches are kept in a "cache" folder inside the mod
+        bool GetCachePath(char* out, uint32 outLen, const char* fileName) {
+            if (!modDirectory[0])
+                return false;
+
+            char cacheDir[MAX_PATH];
+            sprintf_s(cacheDir, "%s\\cache", modDirectory);
+            if (GetFileAttributesA(cacheDir) == INVALID_FILE_ATTRIBUTES && !CreateDirectoryA(cacheDir, nullptr))
+                return false;
+
+            snprintf(out, outLen, "%s\\%s", cacheDir, fileName);
+            return true;
+        }
+    } // namespace Config
+} // namespace OriginsBASS
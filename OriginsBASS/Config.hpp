@@ -0,0 +1,69 @@
+#pragma once
+
+namespace OriginsBASS {
+    namespace Config {
+
+        // How PlaySfx treats a slot whose file is still being loaded
+        enum SFXNotReadyPolicies { SFX_NOTREADY_WAIT, SFX_NOTREADY_DROP };
+
+        // How a loaded SFX is kept in memory. File keeps the file as it is unless it has to be resampled,
+        // the others decode it when it's loaded
+        enum SFXStorageFormats { SFX_STORAGE_FILE, SFX_STORAGE_PCM16, SFX_STORAGE_ADPCM };
+
+        // How a voice plays at a speed other than 1.0.
+        // Resample changes pitch along with speed like the original engine, Tempo keeps the pitch but costs more
+        enum SpeedModes { SPEED_RESAMPLE, SPEED_TEMPO };
+
+        // Output timing picked by [Audio] LatencyProfile. 0 leaves the BASS default
+        struct LatencyProfile {
+            char name[32];
+            uint32 deviceBufferMs;
+            uint32 updatePeriodMs;
+            uint32 updateThreads;
+            uint32 bufferMs;
+        };
+
+        // [Audio]
+        extern bool audioCommandThread;
+        extern uint8 sfxSpeedMode;
+        extern uint8 musicSpeedMode;
+        // A TempoQuality tier, or TEMPO_QUALITY_AUTO / TEMPO_QUALITY_BENCHMARK
+        extern int32 tempoQuality;
+        extern bool prerenderMusic;
+        extern bool dualDeck;
+        // Stopped music streams kept open for a quick restart, 0 disables
+        extern uint32 warmDecoders;
+        extern uint32 musicCacheMB;
+        // Size cap for decoded audio kept on disk across launches, 0 disables
+        extern uint32 pcmCacheMB;
+        extern uint32 suspendDepth;
+        extern uint32 decodeAheadMS;
+        // Bounds for the adaptive playback buffer, a minimum of 0 keeps BASS's defaults
+        extern uint32 bufferMinMS;
+        extern uint32 bufferMaxMS;
+        extern LatencyProfile latencyProfile;
+        // Times every PlaySfx and prints the distribution
+        extern bool measureLatency;
+        // Runs on BASS's no sound device
+        extern bool headless;
+
+        // [SFX]
+        extern uint32 sfxLoadThreads;
+        extern uint8 sfxNotReadyPolicy;
+        extern uint8 sfxGlobalStorage;
+        extern uint8 sfxStageStorage;
+        // 16-bit SFX bigger than this are stored as ADPCM instead, 0 disables
+        extern uint32 sfxADPCMAboveKB;
+        // Measures what ADPCM would cost and save for every SFX that is loaded
+        extern bool sfxStorageBenchmark;
+
+        // [SigScan]
+        extern uint32 sigScanThreads;
+
+        // Directory our DLL was loaded from
+        extern char modDirectory[MAX_PATH];
+
+        void Load();
+        bool GetCachePath(char* out, uint32 outLen, const char* fileName);
+    } // namespace Config
+} // namespace OriginsBASS
@@ -0,0 +1,393 @@
+#include "pch.h"
+#include "DecodeAhead.hpp"
+
+namespace OriginsBASS {
+    namespace DecodeAhead {
+
+        const uint32 MARKER_COUNT  = 256;
+        const uint32 HISTORY_COUNT = 64;
+        const double CHUNK_SECONDS = 0.02;
+
+        // Where a decoded chunk ends in the ring, and where the decoder was at that point
+        struct ChunkMarker {
+            uint64 ringEnd;
+            QWORD decoderEnd;
+            float rate;
+        };
+
+        // Decoder position at a byte of the played stream, recorded by the stream proc
+        struct PositionSample {
+            std::atomic<uint64> outPos;
+            std::atomic<QWORD> decoderPos;
+        };
+
+        struct Feeder {
+            HSTREAM output;
+            HSTREAM decoder;
+            DWORD frameBytes;
+            DWORD chunkBytes;
+
+            // One for the registry, plus one per caller using the feeder without registryLock held
+            std::atomic<uint32> refs{ 1 };
+            // Held while the decoder is used from outside the stream proc
+            std::mutex decodeLock;
+            bool detached = false;
+            std::atomic<bool> freed{ false };
+            std::atomic<bool> ended{ false };
+            std::atomic<float> rate{ 1.0f };
+
+            // Positions count up forever, the ring index is the position modulo its size
+            std::vector<uint8> ring;
+            std::atomic<uint64> writePos{ 0 };
+            std::atomic<uint64> readPos{ 0 };
+            // Everything before this was decoded from before a seek
+            std::atomic<uint64> flushTo{ 0 };
+
+            ChunkMarker markers[MARKER_COUNT];
+            std::atomic<uint32> markerWrite{ 0 };
+            std::atomic<uint32> markerRead{ 0 };
+
+            // Only touched by the stream proc
+            uint64 outPos = 0;
+            PositionSample history[HISTORY_COUNT];
+            std::atomic<uint32> historyWrite{ 0 };
+        };
+
+        static std::mutex registryLock;
+        static std::unordered_map<DWORD, Feeder*> feeders;
+        // Feeders whose handle BASS gave to a new stream before the decode thread reaped them
+        static std::vector<Feeder*> replaced;
+        static HANDLE workerEvent = nullptr;
+        static uint32 bufferMilliseconds = 0;
+        static std::atomic<uint32> underruns{ 0 };
+
+        // First marker past ringPos, or the last one. Markers aren't overwritten before the reader passes them
+        static QWORD DecoderPosAt(Feeder* feeder, uint64 ringPos, uint32 markerIndex) {
+            uint32 markerEnd = feeder->markerWrite.load(std::memory_order_acquire);
+            if (markerIndex == markerEnd)
+                return 0;
+            while (markerIndex + 1 != markerEnd && feeder->markers[markerIndex % MARKER_COUNT].ringEnd <= ringPos)
+                ++markerIndex;
+
+            const ChunkMarker& marker = feeder->markers[markerIndex % MARKER_COUNT];
+            uint64 behind = marker.ringEnd > ringPos ? (uint64)((marker.ringEnd - ringPos) * marker.rate) : 0;
+            behind -= behind % feeder->frameBytes;
+            return marker.decoderEnd > behind ? marker.decoderEnd - behind : 0;
+        }
+
+        static void PushMarker(Feeder* feeder, uint64 ringEnd, QWORD decoderEnd) {
+            uint32 index = feeder->markerWrite.load(std::memory_order_relaxed);
+            feeder->markers[index % MARKER_COUNT] = { ringEnd, decoderEnd, feeder->rate.load(std::memory_order_relaxed) };
+            feeder->markerWrite.store(index + 1, std::memory_order_release);
+        }
+
+        // Runs on the BASS mixer thread, only copies
+        static DWORD CALLBACK FeedProc(HSTREAM handle, void* buffer, DWORD length, void* user) {
+            Feeder* feeder = static_cast<Feeder*>(user);
+            uint64 read    = feeder->readPos.load(std::memory_order_relaxed);
+            uint64 flush   = feeder->flushTo.load(std::memory_order_acquire);
+            if (flush > read)
+                read = flush;
+            bool ended   = feeder->ended.load(std::memory_order_acquire);
+            uint64 write = feeder->writePos.load(std::memory_order_acquire);
+
+            DWORD copied    = (DWORD)(std::min)((uint64)length, write - read);
+            size_t ringSize = feeder->ring.size();
+            size_t start    = (size_t)(read % ringSize);
+            size_t first    = (std::min)((size_t)copied, ringSize - start);
+            memcpy(buffer, feeder->ring.data() + start, first);
+            memcpy(static_cast<uint8*>(buffer) + first, feeder->ring.data(), copied - first);
+            read += copied;
+            feeder->readPos.store(read, std::memory_order_release);
+
+            // Drop markers that are behind, the last one is kept to know where the decoder is
+            uint32 markerIndex = feeder->markerRead.load(std::memory_order_relaxed);
+            uint32 markerEnd   = feeder->markerWrite.load(std::memory_order_acquire);
+            while (markerIndex + 1 < markerEnd && feeder->markers[markerIndex % MARKER_COUNT].ringEnd <= read)
+                ++markerIndex;
+            feeder->markerRead.store(markerIndex, std::memory_order_release);
+
+            DWORD result = length;
+            if (copied < length) {
+                if (ended) {
+                    result = copied | BASS_STREAMPROC_END;
+                }
+                else {
+                    memset(static_cast<uint8*>(buffer) + copied, 0, length - copied);
+                    underruns.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+
+            feeder->outPos += result & ~BASS_STREAMPROC_END;
+            uint32 sample = feeder->historyWrite.load(std::memory_order_relaxed);
+            feeder->history[sample % HISTORY_COUNT].outPos.store(feeder->outPos, std::memory_order_relaxed);
+            feeder->history[sample % HISTORY_COUNT].decoderPos.store(DecoderPosAt(feeder, read, markerIndex), std::memory_order_relaxed);
+            feeder->historyWrite.store(sample + 1, std::memory_order_release);
+
+            if (write - read < ringSize / 2)
+                SetEvent(workerEvent);
+            return result;
+        }
+
+        // Decodes into the ring until it's full or maxChunks were decoded. Returns true if anything was decoded
+        static bool FillLocked(Feeder* feeder, uint32 maxChunks) {
+            if (feeder->detached || feeder->freed.load(std::memory_order_acquire) || feeder->ended.load(std::memory_order_relaxed))
+                return false;
+
+            size_t ringSize = feeder->ring.size();
+            uint32 chunks   = 0;
+            for (; chunks < maxChunks; ++chunks) {
+                uint64 write = feeder->writePos.load(std::memory_order_relaxed);
+                // Flushed bytes stay used until the stream proc has moved past them, it may still be copying them
+                uint64 used  = write - feeder->readPos.load(std::memory_order_acquire);
+                if (ringSize - used < feeder->chunkBytes)
+                    break;
+                if (feeder->markerWrite.load(std::memory_order_relaxed) - feeder->markerRead.load(std::memory_order_acquire) >= MARKER_COUNT - 1)
+                    break;
+
+                size_t start = (size_t)(write % ringSize);
+                DWORD length = (DWORD)(std::min)((size_t)feeder->chunkBytes, ringSize - start);
+                DWORD got    = BASS_ChannelGetData(feeder->decoder, feeder->ring.data() + start, length);
+                if (got == (DWORD)-1 || !got) {
+                    // End of a track that doesn't loop, the stream proc finishes once the ring is empty
+                    feeder->ended.store(true, std::memory_order_release);
+                    break;
+                }
+
+                PushMarker(feeder, write + got, BASS_ChannelGetPosition(feeder->decoder, BASS_POS_BYTE));
+                feeder->writePos.store(write + got, std::memory_order_release);
+            }
+            return chunks != 0;
+        }
+
+        // Decoded right away when a stream is wrapped so it doesn't start on silence: BASS fills the whole playback buffer
+        // when a stream starts, and at least an update period more each time it updates
+        static uint32 PrefillChunks() {
+            DWORD milliseconds = (std::max)(BASS_GetConfig(BASS_CONFIG_BUFFER), BASS_GetConfig(BASS_CONFIG_UPDATEPERIOD));
+            return (uint32)(milliseconds / (CHUNK_SECONDS * 1000.0)) + 1;
+        }
+
+        static bool Fill(Feeder* feeder) {
+            std::lock_guard<std::mutex> guard(feeder->decodeLock);
+            return FillLocked(feeder, UINT32_MAX);
+        }
+
+        // The last reference frees the decoder, unless Unwrap handed it back
+        static void Release(Feeder* feeder) {
+            if (feeder->refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+                return;
+            if (!feeder->detached)
+                BASS_StreamFree(feeder->decoder);
+            delete feeder;
+        }
+
+        static void WorkerMain() {
+            std::vector<Feeder*> active;
+            for (;;) {
+                {
+                    std::lock_guard<std::mutex> guard(registryLock);
+                    active.clear();
+                    // Not in active since the last pass, so the loop below is done with them
+                    for (Feeder* feeder : replaced)
+                        Release(feeder);
+                    replaced.clear();
+                    for (auto it = feeders.begin(); it != feeders.end();) {
+                        Feeder* feeder = it->second;
+                        if (!feeder->freed.load(std::memory_order_acquire)) {
+                            active.push_back(feeder);
+                            ++it;
+                            continue;
+                        }
+
+                        Release(feeder);
+                        it = feeders.erase(it);
+                    }
+                }
+
+                // The registry's reference is only dropped above, so these stay valid until the next pass
+                bool decoded = false;
+                for (Feeder* feeder : active)
+                    decoded |= Fill(feeder);
+                if (!decoded)
+                    WaitForSingleObject(workerEvent, 10);
+            }
+        }
+
+        // Can run on the mixer thread, so it leaves the cleanup to the decode thread
+        static void CALLBACK OutputFreed(HSYNC handle, DWORD channel, DWORD data, void* user) {
+            static_cast<Feeder*>(user)->freed.store(true, std::memory_order_release);
+            SetEvent(workerEvent);
+        }
+
+        // Feeders of freed streams stay listed until the decode thread gets to them
+        static Feeder* Find(DWORD stream) {
+            auto it = feeders.find(stream);
+            return it == feeders.end() || it->second->freed.load(std::memory_order_acquire) ? nullptr : it->second;
+        }
+
+        // Looks the feeder up and takes a reference, so registryLock isn't held while its decoder is used
+        static Feeder* Acquire(DWORD stream) {
+            std::lock_guard<std::mutex> guard(registryLock);
+            Feeder* feeder = Find(stream);
+            if (feeder)
+                feeder->refs.fetch_add(1, std::memory_order_relaxed);
+            return feeder;
+        }
+
+        void SetBufferLength(uint32 milliseconds) { bufferMilliseconds = milliseconds; }
+
+        bool Enabled() { return bufferMilliseconds != 0; }
+
+        HSTREAM Wrap(HSTREAM decoder) {
+            BASS_CHANNELINFO info;
+            if (!bufferMilliseconds || !BASS_ChannelGetInfo(decoder, &info))
+                return 0;
+
+            if (!workerEvent) {
+                workerEvent = CreateEventA(nullptr, FALSE, FALSE, nullptr);
+                std::thread worker(WorkerMain);
+                SetThreadPriority(worker.native_handle(), THREAD_PRIORITY_ABOVE_NORMAL);
+                worker.detach();
+            }
+
+            Feeder* feeder     = new Feeder();
+            feeder->decoder    = decoder;
+            feeder->frameBytes = info.chans * (info.flags & BASS_SAMPLE_FLOAT ? 4 : info.flags & BASS_SAMPLE_8BITS ? 1 : 2);
+            feeder->chunkBytes = (DWORD)BASS_ChannelSeconds2Bytes(decoder, CHUNK_SECONDS);
+            feeder->chunkBytes -= feeder->chunkBytes % feeder->frameBytes;
+            QWORD ringBytes    = BASS_ChannelSeconds2Bytes(decoder, bufferMilliseconds / 1000.0);
+            ringBytes          = (std::max)(ringBytes - ringBytes % feeder->frameBytes, (QWORD)feeder->chunkBytes * 4);
+            feeder->ring.resize((size_t)ringBytes);
+            float tempo;
+            if (BASS_ChannelGetAttribute(decoder, BASS_ATTRIB_TEMPO, &tempo))
+                feeder->rate.store(1.0f + tempo / 100.0f, std::memory_order_relaxed);
+            PushMarker(feeder, 0, BASS_ChannelGetPosition(decoder, BASS_POS_BYTE));
+
+            DWORD flags    = info.flags & (BASS_SAMPLE_FLOAT | BASS_SAMPLE_8BITS);
+            feeder->output = BASS_StreamCreate(info.freq, info.chans, flags, FeedProc, feeder);
+            if (!feeder->output) {
+                delete feeder;
+                return 0;
+            }
+
+            // Fill before the first play so it doesn't start on silence
+            FillLocked(feeder, PrefillChunks());
+            {
+                std::lock_guard<std::mutex> guard(registryLock);
+                // BASS can hand out the handle of a freed stream again before the decode thread cleaned up after it.
+                // That thread may be filling the old feeder right now, so it is left for it to reap
+                auto it = feeders.find(feeder->output);
+                if (it != feeders.end())
+                    replaced.push_back(it->second);
+                feeders[feeder->output] = feeder;
+            }
+            BASS_ChannelSetSync(feeder->output, BASS_SYNC_FREE, 0, OutputFreed, feeder);
+            return feeder->output;
+        }
+
+        HSTREAM Unwrap(HSTREAM stream) {
+            Feeder* feeder = Acquire(stream);
+            if (!feeder)
+                return stream;
+
+            HSTREAM decoder;
+            {
+                std::lock_guard<std::mutex> decodeGuard(feeder->decodeLock);
+                feeder->detached = true;
+                decoder          = feeder->decoder;
+            }
+            Release(feeder);
+            BASS_StreamFree(stream);
+            return decoder;
+        }
+
+        DWORD Source(DWORD stream) {
+            std::lock_guard<std::mutex> guard(registryLock);
+            Feeder* feeder = Find(stream);
+            return feeder ? feeder->decoder : stream;
+        }
+
+        static QWORD GetPosition(Feeder* feeder, DWORD stream) {
+            // The stream proc runs ahead of what is heard by the device buffer, so look back to the heard byte
+            QWORD heard  = BASS_ChannelGetPosition(stream, BASS_POS_BYTE);
+            uint32 count = feeder->historyWrite.load(std::memory_order_acquire);
+            uint32 limit = count > HISTORY_COUNT ? count - HISTORY_COUNT : 0;
+            QWORD outPos = 0, decoderPos = 0;
+            for (uint32 i = count; i > limit; --i) {
+                const PositionSample& sample = feeder->history[(i - 1) % HISTORY_COUNT];
+                outPos     = sample.outPos.load(std::memory_order_relaxed);
+                decoderPos = sample.decoderPos.load(std::memory_order_relaxed);
+                if (outPos <= heard)
+                    break;
+            }
+            if (!count)
+                return BASS_ChannelGetPosition(feeder->decoder, BASS_POS_BYTE);
+            return outPos <= heard ? decoderPos + (QWORD)((heard - outPos) * feeder->rate.load(std::memory_order_relaxed)) : decoderPos;
+        }
+
+        QWORD GetPosition(DWORD stream) {
+            Feeder* feeder = Acquire(stream);
+            if (!feeder)
+                return BASS_ChannelGetPosition(stream, BASS_POS_BYTE);
+            QWORD position = GetPosition(feeder, stream);
+            Release(feeder);
+            return position;
+        }
+
+        // Called with decodeLock held. Throws away what's buffered, the decode thread carries on from the decoder's position
+        static void Flush(Feeder* feeder) {
+            uint64 write = feeder->writePos.load(std::memory_order_relaxed);
+            PushMarker(feeder, write, BASS_ChannelGetPosition(feeder->decoder, BASS_POS_BYTE));
+            feeder->flushTo.store(write, std::memory_order_release);
+            feeder->ended.store(false, std::memory_order_release);
+            // The stream proc only runs while the output plays or stalls, or on this thread when it starts playing. Otherwise
+            // nothing can be reading the flushed bytes and their space is free right away
+            DWORD active = BASS_ChannelIsActive(feeder->output);
+            if (active == BASS_ACTIVE_STOPPED || active == BASS_ACTIVE_PAUSED)
+                feeder->readPos.store(write, std::memory_order_release);
+            SetEvent(workerEvent);
+        }
+
+        static bool SetPosition(Feeder* feeder, QWORD position) {
+            std::lock_guard<std::mutex> decodeGuard(feeder->decodeLock);
+            if (!BASS_ChannelSetPosition(feeder->decoder, position, BASS_POS_BYTE))
+                return false;
+            Flush(feeder);
+            return true;
+        }
+
+        bool SetPosition(DWORD stream, QWORD position) {
+            Feeder* feeder = Acquire(stream);
+            if (!feeder)
+                return BASS_ChannelSetPosition(stream, position, BASS_POS_BYTE);
+            bool result = SetPosition(feeder, position);
+            Release(feeder);
+            return result;
+        }
+
+        static bool SetTempo(Feeder* feeder, float value) {
+            // Carry on from the next byte the stream proc will read, at the new tempo
+            std::lock_guard<std::mutex> decodeGuard(feeder->decodeLock);
+            uint64 read      = (std::max)(feeder->readPos.load(std::memory_order_acquire), feeder->flushTo.load(std::memory_order_relaxed));
+            QWORD continueAt = DecoderPosAt(feeder, read, feeder->markerRead.load(std::memory_order_acquire));
+            if (!BASS_ChannelSetAttribute(feeder->decoder, BASS_ATTRIB_TEMPO, value))
+                return false;
+            feeder->rate.store(1.0f + value / 100.0f, std::memory_order_relaxed);
+            BASS_ChannelSetPosition(feeder->decoder, continueAt, BASS_POS_BYTE);
+            Flush(feeder);
+            return true;
+        }
+
+        bool SetAttribute(DWORD stream, DWORD attrib, float value) {
+            Feeder* feeder = Acquire(stream);
+            if (!feeder)
+                return BASS_ChannelSetAttribute(stream, attrib, value);
+            bool result = attrib == BASS_ATTRIB_TEMPO ? SetTempo(feeder, value) : BASS_ChannelSetAttribute(feeder->decoder, attrib, value);
+            Release(feeder);
+            return result;
+        }
+
+        uint32 UnderrunCount() { return underruns.load(std::memory_order_relaxed); }
+
+    } // namespace DecodeAhead
+} // namespace OriginsBASS
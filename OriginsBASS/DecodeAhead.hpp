@@ -0,0 +1,31 @@
+#pragma once
+
+namespace OriginsBASS {
+
+    // Runs music decoders (and their tempo processors) on a thread of their own, well ahead of playback.
+    // The stream BASS plays only copies out of a ring buffer, so a slow decode can't stall the mixer
+    // and a hitch on the decode thread is covered by whatever is buffered.
+    // Every function takes the stream that is played, wrapped or not, and falls back to plain BASS calls
+    // for streams that aren't wrapped.
+    namespace DecodeAhead {
+        void SetBufferLength(uint32 milliseconds);
+        bool Enabled();
+
+        // Takes ownership of a decoding stream and returns the stream to play, or 0 if it can't be wrapped
+        HSTREAM Wrap(HSTREAM decoder);
+        // Frees the played stream but keeps the decoder and returns it. Returns the stream itself if it isn't wrapped
+        HSTREAM Unwrap(HSTREAM stream);
+
+        // The stream to set syncs, tempo options and lengths on
+        DWORD Source(DWORD stream);
+        // Byte position of the decoder at the point that is being heard
+        QWORD GetPosition(DWORD stream);
+        // Moves the decoder and drops what was buffered from the old position
+        bool SetPosition(DWORD stream, QWORD position);
+        // Attributes of the decoder. Changing the tempo drops what was buffered at the old tempo
+        bool SetAttribute(DWORD stream, DWORD attrib, float value);
+
+        uint32 UnderrunCount();
+    } // namespace DecodeAhead
+
+} // namespace OriginsBASS
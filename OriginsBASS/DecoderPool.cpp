@@ -0,0 +1,63 @@
+#include "pch.h"
+#include "DecoderPool.hpp"
+
+namespace OriginsBASS {
+    namespace DecoderPool {
+
+        struct PoolEntry {
+            std::string path;
+            DWORD flags;
+            bool tempo;
+            HSTREAM stream;
+        };
+
+        // Least recently stopped first
+        static std::deque<PoolEntry> entries;
+        static uint32 poolCapacity = 0;
+
+        static void Trim() {
+            while (entries.size() > poolCapacity) {
+                BASS_StreamFree(entries.front().stream);
+                entries.pop_front();
+            }
+        }
+
+        void SetCapacity(uint32 capacity) {
+            poolCapacity = capacity;
+            Trim();
+        }
+
+        HSTREAM Acquire(const char* path, DWORD flags, bool tempo) {
+            for (auto it = entries.rbegin(); it != entries.rend(); ++it) {
+                if (it->flags != flags || it->tempo != tempo || _stricmp(it->path.c_str(), path))
+                    continue;
+
+                HSTREAM stream = it->stream;
+                entries.erase(std::next(it).base());
+
+                // Rewinding also flushes whatever the tempo processor had buffered
+                if (!BASS_ChannelSetPosition(stream, 0, BASS_POS_BYTE)) {
+                    BASS_StreamFree(stream);
+                    return 0;
+                }
+                BASS_ChannelSetAttribute(stream, BASS_ATTRIB_VOL, 1.0f);
+                BASS_ChannelSetAttribute(stream, BASS_ATTRIB_PAN, 0.0f);
+                BASS_ChannelSetAttribute(stream, BASS_ATTRIB_FREQ, 0.0f);
+                if (tempo)
+                    BASS_ChannelSetAttribute(stream, BASS_ATTRIB_TEMPO, 0.0f);
+                return stream;
+            }
+            return 0;
+        }
+
+        bool Release(const char* path, DWORD flags, bool tempo, HSTREAM stream) {
+            if (!poolCapacity)
+                return false;
+
+            entries.push_back({ path, flags, tempo, stream });
+            Trim();
+            return true;
+        }
+
+    } // namespace DecoderPool
+} // namespace OriginsBASS
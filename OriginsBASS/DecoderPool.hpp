@@ -0,0 +1,17 @@
+#pragma once
+
+namespace OriginsBASS {
+
+    // Streams of recently stopped music, kept open so starting the same file again
+    // (restarting an act, coming back from a jingle) just rewinds instead of reopening and parsing it.
+    // Only used from the thread that owns the channels.
+    namespace DecoderPool {
+        void SetCapacity(uint32 capacity);
+
+        // Takes a matching stream out of the pool, rewound and with its attributes reset. Returns 0 if there is none
+        HSTREAM Acquire(const char* path, DWORD flags, bool tempo);
+        // Keeps a stopped stream for later. Returns false if the pool is disabled and the caller should free it
+        bool Release(const char* path, DWORD flags, bool tempo, HSTREAM stream);
+    } // namespace DecoderPool
+
+} // namespace OriginsBASS
@@ -0,0 +1,246 @@
+#include "pch.h"
+#include "DualDeck.hpp"
+#include "MusicCache.hpp"
+
+namespace OriginsBASS {
+    namespace DualDeck {
+
+        const float DECK_CROSSFADE_SECONDS = 0.05f;
+        // Up to this far behind, the incoming decoder is caught up by decoding instead of seeking
+        const float DECK_MAX_SKIP_SECONDS = 1.0f;
+
+        struct DeckSource {
+            HSTREAM stream;
+            bool loops;
+            QWORD loopStart;
+            // 0 loops at the end of the file
+            QWORD loopEnd;
+            double length;
+        };
+
+        struct Deck {
+            DeckSource sources[2];
+            // Only changed by DeckProc, at the end of a crossfade
+            std::atomic<uint8> active;
+            DWORD frameBytes;
+            uint32 fadeFrames;
+            std::atomic<uint32> fadeRemaining;
+            std::atomic<bool> switchRequested;
+            // Position of the outgoing decoder when Switch lined the incoming one up with it
+            std::atomic<QWORD> alignedPos;
+            std::atomic<DWORD>* activeStream;
+            std::vector<float> scratch;
+        };
+
+        static bool OpenSource(DeckSource& source, const DeckTrack& track) {
+            source.stream = MusicCache::CreateStream(track.path, BASS_STREAM_DECODE | BASS_SAMPLE_FLOAT);
+            if (!source.stream)
+                source.stream = BASS_StreamCreateFile(false, track.path, 0, 0, BASS_STREAM_DECODE | BASS_SAMPLE_FLOAT);
+            if (!source.stream)
+                return false;
+
+            source.loops     = track.loopStart != 0;
+            source.loopStart = BASS_ChannelSeconds2Bytes(source.stream, track.loopStart / 44100.0);
+            source.loopEnd   = track.loopEnd == -1 ? 0 : BASS_ChannelSeconds2Bytes(source.stream, track.loopEnd / 44100.0);
+            source.length    = BASS_ChannelBytes2Seconds(source.stream, BASS_ChannelGetLength(source.stream, BASS_POS_BYTE));
+            return source.length > 0.0;
+        }
+
+        // Reads from a decoder, following its loop. Returns fewer bytes only when a track without a loop ends
+        static DWORD ReadSource(DeckSource& source, float* out, DWORD length) {
+            DWORD done     = 0;
+            uint32 restart = 0;
+            while (done < length) {
+                DWORD request = length - done;
+                if (source.loops && source.loopEnd) {
+                    QWORD pos = BASS_ChannelGetPosition(source.stream, BASS_POS_BYTE);
+                    if (pos >= source.loopEnd) {
+                        BASS_ChannelSetPosition(source.stream, source.loopStart, BASS_POS_BYTE);
+                        pos = source.loopStart;
+                    }
+                    request = (DWORD)(std::min)((QWORD)request, source.loopEnd - pos);
+                }
+
+                DWORD read = BASS_ChannelGetData(source.stream, reinterpret_cast<uint8*>(out) + done, request);
+                if (read == (DWORD)-1 || !read) {
+                    // A loop that immediately ends again would spin forever
+                    if (!source.loops || ++restart > 1)
+                        break;
+                    BASS_ChannelSetPosition(source.stream, source.loopStart, BASS_POS_BYTE);
+                    continue;
+                }
+                restart = 0;
+                done += read;
+            }
+            return done;
+        }
+
+        // Converts a distance in one source to the musically equivalent distance in the other
+        static QWORD ScaleBytes(const DeckSource& from, const DeckSource& to, QWORD bytes) {
+            return BASS_ChannelSeconds2Bytes(to.stream, BASS_ChannelBytes2Seconds(from.stream, bytes) * to.length / from.length);
+        }
+
+        // Runs on the audio thread. Lines the incoming decoder up with the musically equivalent position of the outgoing one
+        static void AlignSource(Deck* deck, uint8 active) {
+            DeckSource& current = deck->sources[active];
+            DeckSource& next    = deck->sources[active ^ 1];
+
+            QWORD currentPos = BASS_ChannelGetPosition(current.stream, BASS_POS_BYTE);
+            QWORD target     = ScaleBytes(current, next, currentPos);
+            QWORD nextPos    = BASS_ChannelGetPosition(next.stream, BASS_POS_BYTE);
+            deck->alignedPos.store(currentPos, std::memory_order_relaxed);
+
+            QWORD maxSkip = BASS_ChannelSeconds2Bytes(next.stream, DECK_MAX_SKIP_SECONDS);
+            if (target < nextPos || target - nextPos > maxSkip) {
+                BASS_ChannelSetPosition(next.stream, target, BASS_POS_BYTE);
+                return;
+            }
+
+            // Short gaps, such as switching straight back, are decoded through instead of seeking
+            float block[0x1000];
+            QWORD skip = target - nextPos;
+            while (skip) {
+                DWORD request = (DWORD)(std::min)((QWORD)sizeof(block), skip);
+                DWORD read    = BASS_ChannelGetData(next.stream, block, request);
+                if (read == (DWORD)-1 || !read)
+                    break;
+                skip -= read;
+            }
+        }
+
+        // Runs on the mixer thread. The outgoing decoder kept playing between Switch and the crossfade starting,
+        // the incoming one is decoded through the same stretch of music so they stay lined up without a seek here
+        static void CatchUpSource(Deck* deck, uint8 active) {
+            DeckSource& current = deck->sources[active];
+            DeckSource& next    = deck->sources[active ^ 1];
+
+            QWORD pos     = BASS_ChannelGetPosition(current.stream, BASS_POS_BYTE);
+            QWORD aligned = deck->alignedPos.load(std::memory_order_relaxed);
+            QWORD played  = 0;
+            if (pos >= aligned) {
+                played = pos - aligned;
+            }
+            else if (current.loops) {
+                // The outgoing track went round its loop in between
+                QWORD loopEnd = current.loopEnd ? current.loopEnd : BASS_ChannelSeconds2Bytes(current.stream, current.length);
+                if (loopEnd > aligned && pos >= current.loopStart)
+                    played = (loopEnd - aligned) + (pos - current.loopStart);
+            }
+
+            QWORD skip = (std::min)(ScaleBytes(current, next, played), BASS_ChannelSeconds2Bytes(next.stream, DECK_MAX_SKIP_SECONDS));
+            skip -= skip % deck->frameBytes;
+            DWORD scratchBytes = (DWORD)(deck->scratch.size() * sizeof(float));
+            scratchBytes -= scratchBytes % deck->frameBytes;
+            while (skip) {
+                DWORD request = (DWORD)(std::min)((QWORD)scratchBytes, skip);
+                DWORD read    = ReadSource(next, deck->scratch.data(), request);
+                if (!read)
+                    break;
+                skip -= read;
+            }
+        }
+
+        static DWORD CALLBACK DeckProc(HSTREAM handle, void* buffer, DWORD length, void* user) {
+            Deck* deck = static_cast<Deck*>(user);
+            float* out = static_cast<float*>(buffer);
+            length -= length % deck->frameBytes;
+            uint8 active = deck->active.load(std::memory_order_relaxed);
+
+            if (!deck->fadeRemaining.load(std::memory_order_relaxed) && deck->switchRequested.exchange(false, std::memory_order_acquire)) {
+                CatchUpSource(deck, active);
+                deck->fadeRemaining.store(deck->fadeFrames, std::memory_order_relaxed);
+            }
+
+            DWORD read = ReadSource(deck->sources[active], out, length);
+            memset(reinterpret_cast<uint8*>(out) + read, 0, length - read);
+
+            uint32 fadeRemaining = deck->fadeRemaining.load(std::memory_order_relaxed);
+            if (!fadeRemaining)
+                return read < length ? read | BASS_STREAMPROC_END : length;
+
+            // Linear crossfade, both sides are the same music at the same point. The scratch buffer is sized in Create,
+            // longer requests are mixed a piece at a time so nothing is allocated on the mixer thread
+            uint32 chans       = deck->frameBytes / sizeof(float);
+            DWORD scratchBytes = (DWORD)(deck->scratch.size() * sizeof(float));
+            scratchBytes -= scratchBytes % deck->frameBytes;
+            for (DWORD offset = 0; offset < length; offset += scratchBytes) {
+                DWORD piece        = (std::min)(scratchBytes, length - offset);
+                float* block       = out + offset / sizeof(float);
+                float* incoming    = deck->scratch.data();
+                DWORD incomingRead = ReadSource(deck->sources[active ^ 1], incoming, piece);
+                memset(reinterpret_cast<uint8*>(incoming) + incomingRead, 0, piece - incomingRead);
+
+                uint32 frames = piece / deck->frameBytes;
+                for (uint32 f = 0; f < frames; ++f) {
+                    float mix = fadeRemaining ? 1.0f - (float)fadeRemaining / deck->fadeFrames : 1.0f;
+                    for (uint32 c = 0; c < chans; ++c) {
+                        float& sample = block[f * chans + c];
+                        sample += (incoming[f * chans + c] - sample) * mix;
+                    }
+                    if (fadeRemaining)
+                        --fadeRemaining;
+                }
+            }
+            // The new side is published before the fade is seen to end, Switch relies on that
+            if (!fadeRemaining) {
+                deck->active.store(active ^ 1, std::memory_order_relaxed);
+                deck->activeStream->store(deck->sources[active ^ 1].stream, std::memory_order_release);
+            }
+            deck->fadeRemaining.store(fadeRemaining, std::memory_order_release);
+            return length;
+        }
+
+        static void CALLBACK DeckFreed(HSYNC handle, DWORD channel, DWORD data, void* user) {
+            Deck* deck = static_cast<Deck*>(user);
+            // The channel may have moved on to another deck by now, only clear it if it still points at this one
+            DWORD active = deck->sources[deck->active.load(std::memory_order_relaxed)].stream;
+            deck->activeStream->compare_exchange_strong(active, 0, std::memory_order_release);
+            BASS_StreamFree(deck->sources[0].stream);
+            BASS_StreamFree(deck->sources[1].stream);
+            delete deck;
+        }
+
+        HSTREAM Create(const DeckTrack& main, const DeckTrack& alt, std::atomic<DWORD>* activeStream, Deck** deckOut) {
+            Deck* deck = new Deck();
+            BASS_CHANNELINFO mainInfo, altInfo;
+            bool opened = OpenSource(deck->sources[0], main) && OpenSource(deck->sources[1], alt)
+                          && BASS_ChannelGetInfo(deck->sources[0].stream, &mainInfo) && BASS_ChannelGetInfo(deck->sources[1].stream, &altInfo);
+
+            // Mixing needs both in the same format
+            HSTREAM stream = 0;
+            if (opened && mainInfo.freq == altInfo.freq && mainInfo.chans == altInfo.chans)
+                stream = BASS_StreamCreate(mainInfo.freq, mainInfo.chans, BASS_SAMPLE_FLOAT, DeckProc, deck);
+
+            if (!stream) {
+                BASS_StreamFree(deck->sources[0].stream);
+                BASS_StreamFree(deck->sources[1].stream);
+                delete deck;
+                return 0;
+            }
+
+            deck->frameBytes   = mainInfo.chans * sizeof(float);
+            deck->fadeFrames   = (uint32)(mainInfo.freq * DECK_CROSSFADE_SECONDS);
+            deck->activeStream = activeStream;
+            // Enough for the whole playback buffer, so a crossfade is normally mixed in one piece
+            DWORD scratchMs = (std::max)(BASS_GetConfig(BASS_CONFIG_BUFFER), (DWORD)100);
+            deck->scratch.resize((size_t)mainInfo.freq * mainInfo.chans * scratchMs / 1000);
+            activeStream->store(deck->sources[0].stream, std::memory_order_release);
+            BASS_ChannelSetSync(stream, BASS_SYNC_FREE, 0, DeckFreed, deck);
+
+            *deckOut = deck;
+            return stream;
+        }
+
+        bool Switch(Deck* deck) {
+            if (deck->fadeRemaining.load(std::memory_order_acquire) || deck->switchRequested.load(std::memory_order_relaxed))
+                return false;
+
+            // With no crossfade running or requested, DeckProc doesn't touch the idle decoder or change sides,
+            // so it's lined up here rather than on the mixer thread. DeckProc only catches it up and flips
+            AlignSource(deck, deck->active.load(std::memory_order_relaxed));
+            deck->switchRequested.store(true, std::memory_order_release);
+            return true;
+        }
+
+    } // namespace DualDeck
+} // namespace OriginsBASS
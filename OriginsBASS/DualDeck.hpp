@@ -0,0 +1,26 @@
+#pragma once
+
+namespace OriginsBASS {
+
+    // Plays a track and its normal/fast counterpart as one BASS stream.
+    // Both files are kept open as decoders, and a switch crossfades from one to the other
+    // inside the stream's own callback, so it lines up with the mixer sample for sample.
+    namespace DualDeck {
+        struct Deck;
+
+        struct DeckTrack {
+            const char* path;
+            // In samples at 44100Hz like LoadStream, loopEnd -1 loops at the end of the file
+            int32 loopStart;
+            int32 loopEnd;
+        };
+
+        // Opens both tracks and returns the playable stream, or 0 if they can't be played together.
+        // Freeing the stream frees the decoders too. activeStream is kept pointing at the decoder being heard
+        HSTREAM Create(const DeckTrack& main, const DeckTrack& alt, std::atomic<DWORD>* activeStream, Deck** deck);
+        // Starts a crossfade to the other track at the same point in the music. Lines the idle decoder up first,
+        // seeking it if need be, so call it from the audio thread rather than a BASS callback
+        bool Switch(Deck* deck);
+    } // namespace DualDeck
+
+} // namespace OriginsBASS
@@ -0,0 +1,53 @@
+#pragma once
+
+namespace OriginsBASS {
+
+    // Final avalanche step (MurmurHash3 fmix64)
+    inline uint64 HashMix(uint64 h) {
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDull;
+        h ^= h >> 33;
+        h *= 0xC4CEB9FE1A85EC53ull;
+        h ^= h >> 33;
+        return h;
+    }
+
+    inline uint64 HashRead64(const uint8* p) {
+        uint64 v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    // Fast non-cryptographic 64-bit hash, used for cache keys and content dedup.
+    // Large inputs are consumed as four independent lanes so the multiplies overlap.
+    inline uint64 Hash64(const void* data, size_t length, uint64 seed = 0) {
+        const uint64 prime = 0x9E3779B97F4A7C15ull;
+        const uint8* p     = static_cast<const uint8*>(data);
+        uint64 h           = seed ^ (length * prime);
+
+        if (length >= 32) {
+            uint64 lanes[4] = { h, h + prime, h ^ 0x2545F4914F6CDD1Dull, h - prime };
+            while (length >= 32) {
+                for (int l = 0; l < 4; ++l)
+                    lanes[l] = (lanes[l] ^ HashMix(HashRead64(p + l * 8))) * prime;
+                p += 32;
+                length -= 32;
+            }
+            h = HashMix(lanes[0]) ^ (HashMix(lanes[1]) * 3) ^ (HashMix(lanes[2]) * 5) ^ (HashMix(lanes[3]) * 7);
+        }
+
+        while (length >= 8) {
+            h = (h ^ HashMix(HashRead64(p))) * prime;
+            p += 8;
+            length -= 8;
+        }
+
+        uint64 tail = 0;
+        memcpy(&tail, p, length);
+        h = (h ^ HashMix(tail ^ length)) * prime;
+        return HashMix(h);
+    }
+
+    inline uint64 HashString(const char* str, uint64 seed = 0) { return Hash64(str, strlen(str), seed); }
+
+} // namespace OriginsBASS
@@ -0,0 +1,562 @@
+/**
+ * OriginsBASS
+ * Zero-copy INI file parser.
+ */
+
+#include "IniView.hpp"
+
+#ifdef _WIN32
+# ifndef WIN32_LEAN_AND_MEAN
+#  define WIN32_LEAN_AND_MEAN
+# endif
+# include <windows.h>
+#else
+# include <cstdio>
+#endif
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <emmintrin.h>
+using std::string;
+using std::string_view;
+
+static const size_t npos = string_view::npos;
+
+/**
+ * Index of the lowest set bit.
+ * @param mask Non-zero mask.
+ */
+static inline uint32_t lowestBit(uint32_t mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+/**
+ * isspace() in the C locale, without the function call.
+ */
+static inline bool isSpace(char c)
+{
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+/**
+ * tolower() in the C locale, without the function call.
+ */
+static inline char lower(char c)
+{
+	return (c >= 'A' && c <= 'Z') ? (char)(c + ('a' - 'A')) : c;
+}
+
+/**
+ * Compare two names, ignoring ASCII case.
+ * @return <0, 0 or >0, like strcmp.
+ */
+static int compareNoCase(string_view a, string_view b)
+{
+	const size_t len = std::min(a.size(), b.size());
+	for (size_t i = 0; i < len; i++)
+	{
+		const char ca = lower(a[i]);
+		const char cb = lower(b[i]);
+		if (ca != cb)
+			return (unsigned char)ca < (unsigned char)cb ? -1 : 1;
+	}
+	return a.size() < b.size() ? -1 : (a.size() > b.size() ? 1 : 0);
+}
+
+/**
+ * Check if a character is one the parser has to stop at.
+ * '[' and '#' are only meaningful at the start of a line, so they're checked there instead.
+ */
+static inline bool isSpecialChar(char c)
+{
+	return c == '\n' || c == ';' || c == '=' || c == ':' || c == ']';
+}
+
+/**
+ * Find special characters in a 16-byte block.
+ * @param p Block start.
+ * @return Bitmask of special character positions.
+ */
+static inline uint32_t specialMask(const char* p)
+{
+	const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+	__m128i hits = _mm_cmpeq_epi8(block, _mm_set1_epi8('\n'));
+	hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, _mm_set1_epi8(';')));
+	hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, _mm_set1_epi8('=')));
+	hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, _mm_set1_epi8(':')));
+	hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, _mm_set1_epi8(']')));
+	return (uint32_t)_mm_movemask_epi8(hits);
+}
+
+/**
+ * Hash a name, ignoring ASCII case.
+ */
+uint32_t IniView::hashName(string_view name)
+{
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	for (char c : name)
+	{
+		hash ^= (unsigned char)lower(c);
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/**
+ * Hash a key together with the group it's in.
+ */
+uint32_t IniView::hashEntry(uint32_t group, uint32_t keyHash)
+{
+	uint32_t hash = keyHash ^ ((group + 1) * 0x9E3779B9u);
+	hash ^= hash >> 15;
+	hash *= 0x2C1B3C6Du;
+	return hash ^ (hash >> 12);
+}
+
+bool IniView::equalNames(string_view a, string_view b)
+{
+	return a.size() == b.size() && compareNoCase(a, b) == 0;
+}
+
+/**
+ * Size a table for count items, at most half full, keeping what's in it.
+ */
+void IniView::resizeSlots(std::vector<Slot>& slots, size_t count)
+{
+	size_t size = 16;
+	while (size < count * 2)
+		size *= 2;
+	if (size <= slots.size())
+		return;
+
+	std::vector<Slot> old(size, Slot{ 0, 0 });
+	old.swap(slots);
+	for (const Slot& slot : old)
+	{
+		if (slot.index)
+			addSlot(slots, slot.hash, slot.index - 1);
+	}
+}
+
+/**
+ * Add a position to a table. The caller checks it isn't there yet.
+ */
+void IniView::addSlot(std::vector<Slot>& slots, uint32_t hash, uint32_t position)
+{
+	const size_t mask = slots.size() - 1;
+	size_t i = hash & mask;
+	while (slots[i].index)
+		i = (i + 1) & mask;
+	slots[i].hash  = hash;
+	slots[i].index = position + 1;
+}
+
+IniView::IniView(const char* filename)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return;
+	m_file = file;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size))
+		return;
+	m_open = true;
+	if (!size.QuadPart)
+		return;
+
+	m_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!m_mapping)
+		return;
+	m_view = MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!m_view)
+		return;
+
+	parse(static_cast<const char*>(m_view), (size_t)size.QuadPart);
+#else
+	FILE* f = fopen(filename, "rb");
+	if (!f)
+		return;
+	m_open = true;
+
+	char buf[4096];
+	size_t got;
+	while ((got = fread(buf, 1, sizeof(buf), f)) > 0)
+		m_copy.append(buf, got);
+	fclose(f);
+
+	parse(m_copy.data(), m_copy.size());
+#endif
+}
+
+IniView::~IniView()
+{
+#ifdef _WIN32
+	if (m_view)
+		UnmapViewOfFile(m_view);
+	if (m_mapping)
+		CloseHandle(m_mapping);
+	if (m_file)
+		CloseHandle(m_file);
+#endif
+}
+
+/**
+ * Parse INI data.
+ * The data is not copied and must outlive the IniView.
+ * @param data INI text.
+ * @param size Size of the text, in bytes.
+ */
+void IniView::parse(const char* data, size_t size)
+{
+	clear();
+	m_open = true;
+
+	// Create an empty group for keys before the first section.
+	uint32_t curGroup = findOrAddGroup(string_view());
+
+	// Per-line state. Offsets are relative to data.
+	size_t lineStart    = 0;
+	size_t firstDelim   = npos;
+	size_t firstBracket = npos;
+	size_t firstComment = npos;
+
+	// UTF-8 byte order mark.
+	if (size >= 3 && !memcmp(data, "\xEF\xBB\xBF", 3))
+		lineStart = 3;
+
+	auto process = [&](size_t i) {
+		switch (data[i])
+		{
+			case '\n':
+				parseLine(data, lineStart, i, firstDelim, firstBracket, firstComment, curGroup);
+				lineStart    = i + 1;
+				firstDelim   = npos;
+				firstBracket = npos;
+				firstComment = npos;
+				break;
+			case '=':
+			case ':':
+				if (firstDelim == npos)
+					firstDelim = i;
+				break;
+			case ']':
+				if (firstBracket == npos)
+					firstBracket = i;
+				break;
+			case ';':
+				// Only an inline comment after whitespace. At the start of a line it's a comment line anyway.
+				if (firstComment == npos && i > lineStart && isSpace(data[i - 1]))
+					firstComment = i;
+				break;
+			default:
+				break;
+		}
+	};
+
+	size_t block = lineStart;
+	for (; block + 16 <= size; block += 16)
+	{
+		for (uint32_t mask = specialMask(data + block); mask; mask &= mask - 1)
+			process(block + lowestBit(mask));
+	}
+	for (; block < size; block++)
+	{
+		if (isSpecialChar(data[block]))
+			process(block);
+	}
+
+	// Last line without a trailing newline.
+	if (lineStart < size)
+		parseLine(data, lineStart, size, firstDelim, firstBracket, firstComment, curGroup);
+
+	indexEntries();
+}
+
+/**
+ * Build the entry table once all entries are known.
+ * Only the first of duplicate keys goes in, like INIReader::GetInteger().
+ */
+void IniView::indexEntries()
+{
+	m_entrySlots.clear();
+	resizeSlots(m_entrySlots, m_entries.size());
+	const size_t mask = m_entrySlots.size() - 1;
+
+	for (uint32_t position = 0; position < (uint32_t)m_entries.size(); position++)
+	{
+		const Entry& entry = m_entries[position];
+		const uint32_t hash = hashEntry(entry.group, hashName(entry.key));
+		size_t i = hash & mask;
+		bool duplicate = false;
+		for (; m_entrySlots[i].index; i = (i + 1) & mask)
+		{
+			const Slot& slot = m_entrySlots[i];
+			const Entry& other = m_entries[slot.index - 1];
+			if (slot.hash == hash && other.group == entry.group && equalNames(other.key, entry.key))
+			{
+				duplicate = true;
+				break;
+			}
+		}
+		if (!duplicate)
+			m_entrySlots[i] = Slot{ hash, position + 1 };
+	}
+}
+
+/**
+ * Handle a single line.
+ * @param data INI text.
+ * @param lineStart Start of the line.
+ * @param lineEnd End of the line, not including the newline.
+ * @param firstDelim Position of the first '=' or ':', or npos.
+ * @param firstBracket Position of the first ']', or npos.
+ * @param firstComment Position of the first inline comment, or npos.
+ * @param curGroup Current group index.
+ */
+void IniView::parseLine(const char* data, size_t lineStart, size_t lineEnd, size_t firstDelim, size_t firstBracket, size_t firstComment, uint32_t& curGroup)
+{
+	size_t start = lineStart;
+	size_t end   = lineEnd;
+	while (start < end && isSpace(data[start]))
+		start++;
+	while (end > start && isSpace(data[end - 1]))
+		end--;
+	if (start == end || data[start] == ';' || data[start] == '#')
+		return;
+
+	if (data[start] == '[')
+	{
+		// New section. Names aren't trimmed, like INIReader.
+		if (firstBracket != npos && firstBracket < end && (firstComment == npos || firstBracket < firstComment))
+			curGroup = findOrAddGroup(string_view(data + start + 1, firstBracket - start - 1));
+		return;
+	}
+
+	// Lines without a separator are skipped.
+	if (firstDelim == npos || firstDelim >= end || (firstComment != npos && firstComment < firstDelim))
+		return;
+
+	size_t keyEnd = firstDelim;
+	while (keyEnd > start && isSpace(data[keyEnd - 1]))
+		keyEnd--;
+
+	size_t valueStart = firstDelim + 1;
+	while (valueStart < end && isSpace(data[valueStart]))
+		valueStart++;
+
+	// A ';' right where the value starts is part of it, so look for the next comment.
+	size_t valueEnd = end;
+	if (firstComment != npos && firstComment > valueStart)
+	{
+		valueEnd = firstComment;
+	}
+	else if (firstComment == valueStart)
+	{
+		for (size_t i = valueStart + 1; i < end; i++)
+		{
+			if (data[i] == ';' && isSpace(data[i - 1]))
+			{
+				valueEnd = i;
+				break;
+			}
+		}
+	}
+	while (valueEnd > valueStart && isSpace(data[valueEnd - 1]))
+		valueEnd--;
+
+	Entry entry;
+	entry.group = curGroup;
+	entry.key   = string_view(data + start, keyEnd - start);
+	entry.value = string_view(data + valueStart, valueEnd - valueStart);
+	m_entries.push_back(entry);
+	m_groupKeys[curGroup]++;
+}
+
+/**
+ * Find a group's index.
+ * @return Index, or UINT32_MAX if there's no such group.
+ */
+uint32_t IniView::findGroup(string_view section) const
+{
+	if (m_groupSlots.empty())
+		return UINT32_MAX;
+
+	const uint32_t hash = hashName(section);
+	const size_t mask   = m_groupSlots.size() - 1;
+	for (size_t i = hash & mask; m_groupSlots[i].index; i = (i + 1) & mask)
+	{
+		const Slot& slot = m_groupSlots[i];
+		if (slot.hash == hash && equalNames(m_groups[slot.index - 1], section))
+			return slot.index - 1;
+	}
+	return UINT32_MAX;
+}
+
+uint32_t IniView::findOrAddGroup(string_view section)
+{
+	const uint32_t found = findGroup(section);
+	if (found != UINT32_MAX)
+		return found;
+
+	const uint32_t index = (uint32_t)m_groups.size();
+	m_groups.push_back(section);
+	m_groupKeys.push_back(0);
+	resizeSlots(m_groupSlots, m_groups.size());
+	addSlot(m_groupSlots, hashName(section), index);
+	return index;
+}
+
+const IniView::Entry* IniView::find(string_view section, string_view key) const
+{
+	const uint32_t group = findGroup(section);
+	if (group == UINT32_MAX || m_entrySlots.empty())
+		return nullptr;
+
+	const uint32_t hash = hashEntry(group, hashName(key));
+	const size_t mask   = m_entrySlots.size() - 1;
+	for (size_t i = hash & mask; m_entrySlots[i].index; i = (i + 1) & mask)
+	{
+		const Slot& slot   = m_entrySlots[i];
+		const Entry& entry = m_entries[slot.index - 1];
+		if (slot.hash == hash && entry.group == group && equalNames(entry.key, key))
+			return &entry;
+	}
+	return nullptr;
+}
+
+void IniView::clear()
+{
+	m_groups.clear();
+	m_groupKeys.clear();
+	m_entries.clear();
+	m_groupSlots.clear();
+	m_entrySlots.clear();
+}
+
+bool IniView::isOpen() const
+{
+	return m_open;
+}
+
+/**
+ * Check if the INI file has the specified group.
+ * @param section Section.
+ * @return True if the section exists; false if not.
+ */
+bool IniView::hasGroup(string_view section) const
+{
+	return (findGroup(section) != UINT32_MAX);
+}
+
+/**
+ * Check if the INI file has the specified key.
+ * @param section Section.
+ * @param key Key.
+ * @return True if the key exists; false if not.
+ */
+bool IniView::hasKey(string_view section, string_view key) const
+{
+	return (find(section, key) != nullptr);
+}
+
+/**
+ * Get a string value from the INI file.
+ * @param section Section.
+ * @param key Key.
+ * @param def Default value.
+ * @return String value. Points into the mapped file.
+ */
+string_view IniView::getString(string_view section, string_view key, string_view def) const
+{
+	const Entry* entry = find(section, key);
+	return (entry ? entry->value : def);
+}
+
+/**
+ * Get a boolean value from the INI file.
+ * Accepts true/yes/on/1 and false/no/off/0, like INIReader.
+ * @param section Section.
+ * @param key Key.
+ * @param def Default value.
+ * @return Boolean value, or def if the value isn't one of those.
+ */
+bool IniView::getBool(string_view section, string_view key, bool def) const
+{
+	const Entry* entry = find(section, key);
+	if (!entry)
+		return def;
+
+	static const char* const trueValues[]  = { "true", "yes", "on", "1" };
+	static const char* const falseValues[] = { "false", "no", "off", "0" };
+	for (const char* value : trueValues)
+	{
+		if (compareNoCase(entry->value, value) == 0)
+			return true;
+	}
+	for (const char* value : falseValues)
+	{
+		if (compareNoCase(entry->value, value) == 0)
+			return false;
+	}
+	return def;
+}
+
+/**
+ * Get an integer value from the INI file.
+ * Decimal, 0x hex and 0 octal, like INIReader.
+ * @param section Section.
+ * @param key Key.
+ * @param def Default value.
+ * @return Integer value, or def if the value isn't a number.
+ */
+int IniView::getInt(string_view section, string_view key, int def) const
+{
+	const Entry* entry = find(section, key);
+	if (!entry)
+		return def;
+
+	// Values aren't terminated, strtol needs a copy. Numbers fit on the stack.
+	char buffer[64];
+	string longValue;
+	const char* value = buffer;
+	if (entry->value.size() < sizeof(buffer))
+	{
+		memcpy(buffer, entry->value.data(), entry->value.size());
+		buffer[entry->value.size()] = '\0';
+	}
+	else
+	{
+		longValue = string(entry->value);
+		value     = longValue.c_str();
+	}
+
+	char* end;
+	const long result = strtol(value, &end, 0);
+	return (end > value ? (int)result : def);
+}
+
+/**
+ * Get the names of all sections that have keys, in the order they first appear.
+ * Keys before the first section are in the unnamed section.
+ */
+std::vector<string_view> IniView::groups() const
+{
+	std::vector<string_view> result;
+	for (size_t i = 0; i < m_groups.size(); i++)
+	{
+		if (m_groupKeys[i])
+			result.push_back(m_groups[i]);
+	}
+	return result;
+}
@@ -0,0 +1,112 @@
+/**
+ * OriginsBASS
+ * Zero-copy INI file parser.
+ */
+
+#ifndef INIVIEW_H
+#define INIVIEW_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Read-only INI file.
+ * Accepts the same syntax as inih's INIReader, which the mod's
+ * config.ini and audio.ini were written for: whitespace around names
+ * and values is trimmed, names are case-insensitive, lines starting
+ * with ';' or '#' are comments, ';' after whitespace starts an inline
+ * comment, and '=' or ':' separates a key from its value.
+ * Multi-line values are not supported.
+ *
+ * The whole file is mapped and section names, keys and values are
+ * views into it. Doesn't depend on the mod's headers, so it can be
+ * built on its own.
+ */
+class IniView
+{
+public:
+	IniView() = default;
+	explicit IniView(const char* filename);
+	~IniView();
+
+	IniView(const IniView&) = delete;
+	IniView& operator=(const IniView&) = delete;
+
+	void parse(const char* data, size_t size);
+
+	/**
+	 * Check if the file could be read.
+	 * Like INIReader::ParseError() != -1.
+	 */
+	bool isOpen() const;
+
+	bool hasGroup(std::string_view section) const;
+	bool hasKey(std::string_view section, std::string_view key) const;
+
+	std::string_view getString(std::string_view section, std::string_view key, std::string_view def = std::string_view()) const;
+	bool getBool(std::string_view section, std::string_view key, bool def = false) const;
+	int getInt(std::string_view section, std::string_view key, int def = 0) const;
+
+	/**
+	 * Section names as written, in the order they first appear.
+	 * Sections with no keys are left out.
+	 */
+	std::vector<std::string_view> groups() const;
+
+protected:
+	struct Entry
+	{
+		uint32_t group;
+		std::string_view key;
+		std::string_view value;
+	};
+
+	/**
+	 * Open-addressing hash table slot.
+	 * The hash is kept so probes only compare names when it matches,
+	 * and so the table can grow without hashing names again.
+	 */
+	struct Slot
+	{
+		uint32_t hash;
+		uint32_t index;	// Position + 1, 0 for an empty slot.
+	};
+
+	static uint32_t hashName(std::string_view name);
+	static uint32_t hashEntry(uint32_t group, uint32_t keyHash);
+	static bool equalNames(std::string_view a, std::string_view b);
+	static void resizeSlots(std::vector<Slot>& slots, size_t count);
+	static void addSlot(std::vector<Slot>& slots, uint32_t hash, uint32_t position);
+
+	void clear();
+	void parseLine(const char* data, size_t lineStart, size_t lineEnd, size_t firstDelim, size_t firstBracket, size_t firstComment, uint32_t& curGroup);
+	void indexEntries();
+	uint32_t findGroup(std::string_view section) const;
+	uint32_t findOrAddGroup(std::string_view section);
+	const Entry* find(std::string_view section, std::string_view key) const;
+
+	bool m_open = false;
+
+	// File mapping, or a copy of the file where mapping isn't available.
+	void* m_file = nullptr;
+	void* m_mapping = nullptr;
+	const void* m_view = nullptr;
+	std::string m_copy;
+
+	/**
+	 * Parsed data.
+	 * Groups and entries are kept in file order. Lookups go through
+	 * flat hash tables over them, so a lookup with a string literal or
+	 * a view never allocates and never walks a node list.
+	 * The entry table only holds the first of duplicate keys.
+	 */
+	std::vector<std::string_view> m_groups;
+	std::vector<uint32_t> m_groupKeys;
+	std::vector<Entry> m_entries;
+	std::vector<Slot> m_groupSlots;
+	std::vector<Slot> m_entrySlots;
+};
+
+#endif /* INIVIEW_H */
@@ -0,0 +1,96 @@
+#include "pch.h"
+#include "Config.hpp"
+#include "Latency.hpp"
+#include <algorithm>
+
+namespace OriginsBASS {
+    namespace Latency {
+
+        const uint32 PENDING_COUNT  = 256;
+        const uint32 SAMPLE_COUNT   = 1024;
+        // A report is printed each time this many more sounds were timed
+        const uint32 REPORT_SAMPLES = 200;
+
+        static int64 frequency        = 0;
+        static uint32 deviceLatency   = 0;
+        static int64 pending[PENDING_COUNT];
+        static std::atomic<uint32> pendingNext{ 0 };
+        // Microseconds from the call to the first sample being mixed
+        static uint32 samples[SAMPLE_COUNT];
+        static std::atomic<uint32> sampleCount{ 0 };
+        static uint32 reportedCount = 0;
+
+        void ApplyProfile() {
+            const Config::LatencyProfile& profile = Config::latencyProfile;
+            if (profile.deviceBufferMs)
+                BASS_SetConfig(BASS_CONFIG_DEV_BUFFER, profile.deviceBufferMs);
+            if (profile.updateThreads)
+                BASS_SetConfig(BASS_CONFIG_UPDATETHREADS, profile.updateThreads);
+            if (profile.updatePeriodMs)
+                BASS_SetConfig(BASS_CONFIG_UPDATEPERIOD, profile.updatePeriodMs);
+            if (profile.bufferMs)
+                BASS_SetConfig(BASS_CONFIG_BUFFER, profile.bufferMs);
+
+            LARGE_INTEGER counterFrequency;
+            if (Config::measureLatency && QueryPerformanceFrequency(&counterFrequency))
+                frequency = counterFrequency.QuadPart;
+        }
+
+        void PrintDevice() {
+            // The no sound device has no output delay of its own
+            BASS_INFO info;
+            if (!Config::headless && BASS_GetInfo(&info))
+                deviceLatency = info.latency;
+
+            printf("[OriginsBASS] Latency profile \"%s\": device buffer %u ms, update period %u ms, %u update thread(s), playback buffer %u ms, "
+                   "device latency %u ms%s\n",
+                   Config::latencyProfile.name, BASS_GetConfig(BASS_CONFIG_DEV_BUFFER), BASS_GetConfig(BASS_CONFIG_UPDATEPERIOD),
+                   BASS_GetConfig(BASS_CONFIG_UPDATETHREADS), BASS_GetConfig(BASS_CONFIG_BUFFER), deviceLatency, Config::headless ? " (headless)" : "");
+        }
+
+        int64 Now() {
+            if (!frequency)
+                return 0;
+            LARGE_INTEGER counter;
+            QueryPerformanceCounter(&counter);
+            return counter.QuadPart;
+        }
+
+        // Mixtime, so this runs on the mixer thread as the first sample is rendered
+        static void CALLBACK FirstSample(HSYNC handle, DWORD channel, DWORD data, void* user) {
+            int64 elapsed = Now() - pending[reinterpret_cast<uintptr_t>(user)];
+            uint32 index  = sampleCount.load(std::memory_order_relaxed);
+            samples[index % SAMPLE_COUNT] = (uint32)(elapsed * 1000000 / frequency);
+            sampleCount.store(index + 1, std::memory_order_release);
+        }
+
+        void Track(HSTREAM stream, int64 issued) {
+            if (!frequency || !issued)
+                return;
+
+            uint32 slot   = pendingNext.fetch_add(1, std::memory_order_relaxed) % PENDING_COUNT;
+            pending[slot] = issued;
+            BASS_ChannelSetSync(stream, BASS_SYNC_POS | BASS_SYNC_MIXTIME | BASS_SYNC_ONETIME, 0, FirstSample, reinterpret_cast<void*>((uintptr_t)slot));
+        }
+
+        static float Percentile(const std::vector<uint32>& sorted, float percent) {
+            size_t index = (std::min)((size_t)(sorted.size() * percent / 100.0f), sorted.size() - 1);
+            return sorted[index] / 1000.0f;
+        }
+
+        void Update() {
+            uint32 count = sampleCount.load(std::memory_order_acquire);
+            if (count - reportedCount < REPORT_SAMPLES)
+                return;
+            reportedCount = count;
+
+            std::vector<uint32> sorted(samples, samples + (std::min)(count, SAMPLE_COUNT));
+            std::sort(sorted.begin(), sorted.end());
+            printf("[OriginsBASS] SFX latency over the last %zu sounds, call to first mixed sample (+%u ms device):\n", sorted.size(), deviceLatency);
+            printf("[OriginsBASS]   min %.2f  p50 %.2f  p90 %.2f  p99 %.2f  max %.2f ms\n", sorted.front() / 1000.0f, Percentile(sorted, 50.0f),
+                   Percentile(sorted, 90.0f), Percentile(sorted, 99.0f), sorted.back() / 1000.0f);
+            printf("[OriginsBASS]   to the speaker: p50 %.2f  p99 %.2f ms\n", Percentile(sorted, 50.0f) + deviceLatency, Percentile(sorted, 99.0f) + deviceLatency);
+        }
+
+    } // namespace Latency
+} // namespace OriginsBASS
@@ -0,0 +1,22 @@
+#pragma once
+
+namespace OriginsBASS {
+
+    // Output latency: applies the latency profile picked in the ini, and in measurement mode
+    // times every PlaySfx from the game's call to the mixer rendering the sound's first sample
+    namespace Latency {
+
+        // Call before BASS_Init, the device buffer can't change afterwards
+        void ApplyProfile();
+        // Prints what BASS ended up with. Call after BASS_Init
+        void PrintDevice();
+
+        // Timestamp for a PlaySfx call, 0 when not measuring
+        int64 Now();
+        // Times the first rendered sample of a stream against when it was asked for. Call before playing it
+        void Track(HSTREAM stream, int64 issued);
+        // Prints the distribution every so often. Call from the thread that owns the channels
+        void Update();
+
+    } // namespace Latency
+} // namespace OriginsBASS
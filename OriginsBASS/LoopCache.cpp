@@ -0,0 +1,179 @@
+#include "pch.h"
+#include "LoopCache.hpp"
+#include <algorithm>
+#include <unordered_map>
+
+namespace OriginsBASS {
+    namespace LoopCache {
+
+        const uint32 CACHE_SIGNATURE = 0x434C424F; // "OBLC"
+        const uint32 CACHE_VERSION   = 1;
+
+        struct CacheHeader {
+            uint32 signature;
+            uint32 version;
+            uint64 sourceKey;
+            uint32 entryCount;
+            uint32 stringsSize;
+        };
+
+        // Sorted by name, names are null terminated in the string pool after the entries
+        struct CacheEntry {
+            uint32 nameOffset;
+            int32 loopStart;
+            int32 loopEnd;
+        };
+
+        static HANDLE cacheFile    = INVALID_HANDLE_VALUE;
+        static HANDLE cacheMapping = nullptr;
+        static const void* cacheView = nullptr;
+
+        // Fallback storage when the cache folder isn't writable
+        static std::vector<uint8> cacheMemory;
+
+        static const CacheEntry* entries = nullptr;
+        static const char* strings       = nullptr;
+        static uint32 entryCount         = 0;
+
+        static bool SetView(const uint8* data, size_t size, uint64 sourceKey) {
+            if (size < sizeof(CacheHeader))
+                return false;
+
+            const CacheHeader* header = reinterpret_cast<const CacheHeader*>(data);
+            if (header->signature != CACHE_SIGNATURE || header->version != CACHE_VERSION || header->sourceKey != sourceKey)
+                return false;
+
+            size_t stringsStart = sizeof(CacheHeader) + (size_t)header->entryCount * sizeof(CacheEntry);
+            if (size < stringsStart + header->stringsSize)
+                return false;
+            if (header->stringsSize && data[stringsStart + header->stringsSize - 1] != '\0')
+                return false;
+
+            entries    = reinterpret_cast<const CacheEntry*>(data + sizeof(CacheHeader));
+            strings    = reinterpret_cast<const char*>(data + stringsStart);
+            entryCount = header->entryCount;
+            return true;
+        }
+
+        static void Close() {
+            entries    = nullptr;
+            strings    = nullptr;
+            entryCount = 0;
+
+            if (cacheView)
+                UnmapViewOfFile(cacheView);
+            if (cacheMapping)
+                CloseHandle(cacheMapping);
+            if (cacheFile != INVALID_HANDLE_VALUE)
+                CloseHandle(cacheFile);
+            cacheView    = nullptr;
+            cacheMapping = nullptr;
+            cacheFile    = INVALID_HANDLE_VALUE;
+        }
+
+        bool Open(const char* cachePath, uint64 sourceKey) {
+            Close();
+
+            cacheFile = CreateFileA(cachePath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (cacheFile == INVALID_HANDLE_VALUE)
+                return false;
+
+            LARGE_INTEGER size;
+            if (GetFileSizeEx(cacheFile, &size) && size.QuadPart >= (LONGLONG)sizeof(CacheHeader)) {
+                cacheMapping = CreateFileMappingA(cacheFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+                if (cacheMapping)
+                    cacheView = MapViewOfFile(cacheMapping, FILE_MAP_READ, 0, 0, 0);
+                if (cacheView && SetView(static_cast<const uint8*>(cacheView), (size_t)size.QuadPart, sourceKey))
+                    return true;
+            }
+
+            Close();
+            return false;
+        }
+
+        void Build(const char* cachePath, uint64 sourceKey, const std::unordered_map<std::string, AudioInfo>& table) {
+            std::vector<const std::pair<const std::string, AudioInfo>*> sorted;
+            sorted.reserve(table.size());
+            for (auto& entry : table)
+                sorted.push_back(&entry);
+            std::sort(sorted.begin(), sorted.end(), [](auto* a, auto* b) { return strcmp(a->first.c_str(), b->first.c_str()) < 0; });
+
+            uint32 stringsSize = 0;
+            for (auto* entry : sorted)
+                stringsSize += (uint32)entry->first.size() + 1;
+
+            std::vector<uint8> image(sizeof(CacheHeader) + sorted.size() * sizeof(CacheEntry) + stringsSize);
+            CacheHeader* header = reinterpret_cast<CacheHeader*>(image.data());
+            header->signature   = CACHE_SIGNATURE;
+            header->version     = CACHE_VERSION;
+            header->sourceKey   = sourceKey;
+            header->entryCount  = (uint32)sorted.size();
+            header->stringsSize = stringsSize;
+
+            CacheEntry* outEntries = reinterpret_cast<CacheEntry*>(image.data() + sizeof(CacheHeader));
+            char* outStrings       = reinterpret_cast<char*>(outEntries + sorted.size());
+            uint32 offset          = 0;
+            for (size_t i = 0; i < sorted.size(); ++i) {
+                outEntries[i].nameOffset = offset;
+                outEntries[i].loopStart  = sorted[i]->second.loopStart;
+                outEntries[i].loopEnd    = sorted[i]->second.loopEnd;
+                memcpy(outStrings + offset, sorted[i]->first.c_str(), sorted[i]->first.size() + 1);
+                offset += (uint32)sorted[i]->first.size() + 1;
+            }
+
+            Close();
+
+            if (!cachePath) {
+                cacheMemory = std::move(image);
+                SetView(cacheMemory.data(), cacheMemory.size(), sourceKey);
+                return;
+            }
+
+            // Write to a temporary file first so a crash never leaves a half written cache
+            char tempPath[MAX_PATH];
+            sprintf_s(tempPath, "%s.tmp", cachePath);
+            bool written = false;
+            HANDLE file  = CreateFileA(tempPath, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (file != INVALID_HANDLE_VALUE) {
+                DWORD bytesWritten = 0;
+                written = WriteFile(file, image.data(), (DWORD)image.size(), &bytesWritten, nullptr) && bytesWritten == image.size();
+                CloseHandle(file);
+                written = written && MoveFileExA(tempPath, cachePath, MOVEFILE_REPLACE_EXISTING);
+                if (!written)
+                    DeleteFileA(tempPath);
+            }
+
+            if (written && Open(cachePath, sourceKey)) {
+                cacheMemory.clear();
+                cacheMemory.shrink_to_fit();
+                printf("[OriginsBASS] Wrote loop cache with %u entries to %s\n", entryCount, cachePath);
+                return;
+            }
+
+            printf("[OriginsBASS] Failed to write loop cache \"%s\", using it from memory\n", cachePath);
+            cacheMemory = std::move(image);
+            SetView(cacheMemory.data(), cacheMemory.size(), sourceKey);
+        }
+
+        bool Find(const char* name, AudioInfo* info) {
+            uint32 low  = 0;
+            uint32 high = entryCount;
+            while (low < high) {
+                uint32 mid = low + (high - low) / 2;
+                int32 cmp  = strcmp(strings + entries[mid].nameOffset, name);
+                if (!cmp) {
+                    info->loopStart = entries[mid].loopStart;
+                    info->loopEnd   = entries[mid].loopEnd;
+                    return true;
+                }
+                if (cmp < 0)
+                    low = mid + 1;
+                else
+                    high = mid;
+            }
+            return false;
+        }
+
+        uint32 EntryCount() { return entryCount; }
+    } // namespace LoopCache
+} // namespace OriginsBASS
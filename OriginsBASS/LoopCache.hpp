@@ -0,0 +1,23 @@
+#pragma once
+
+namespace OriginsBASS {
+
+    struct AudioInfo {
+        int32 loopStart;
+        int32 loopEnd;
+    };
+
+    // Compiled audio.ini loop table.
+    // The merged table is stored as a sorted binary file in the cache folder and
+    // memory-mapped on later launches, so lookups never touch the heap.
+    namespace LoopCache {
+        // Maps the cache if it exists and was built from the same set of audio.ini files
+        bool Open(const char* cachePath, uint64 sourceKey);
+        // Writes a new cache from a parsed table and maps it. Without a path the table is only kept in memory
+        void Build(const char* cachePath, uint64 sourceKey, const std::unordered_map<std::string, AudioInfo>& table);
+
+        bool Find(const char* name, AudioInfo* info);
+        uint32 EntryCount();
+    } // namespace LoopCache
+
+} // namespace OriginsBASS
@@ -0,0 +1,63 @@
+#pragma once
+
+namespace OriginsBASS {
+
+    // Bounded lock-free queue for any number of producers and a single consumer.
+    // Each cell carries a sequence number so producers only contend on the tail index,
+    // and the consumer never has to take a lock to see a finished write.
+    template <typename T, uint32 Capacity> class MPSCQueue {
+        static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+    public:
+        MPSCQueue() {
+            for (uint32 i = 0; i < Capacity; ++i)
+                cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        // Returns false when the queue is full
+        bool TryPush(const T& item) {
+            uint32 pos = tail.load(std::memory_order_relaxed);
+            for (;;) {
+                Cell& cell = cells[pos & (Capacity - 1)];
+                uint32 seq = cell.sequence.load(std::memory_order_acquire);
+                int32 diff = (int32)(seq - pos);
+                if (!diff) {
+                    if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        cell.item = item;
+                        cell.sequence.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (diff < 0) {
+                    return false;
+                }
+                else {
+                    pos = tail.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // Only call from the consumer thread
+        bool TryPop(T& item) {
+            Cell& cell = cells[head & (Capacity - 1)];
+            if (cell.sequence.load(std::memory_order_acquire) != head + 1)
+                return false;
+
+            item = cell.item;
+            cell.sequence.store(head + Capacity, std::memory_order_release);
+            ++head;
+            return true;
+        }
+
+    private:
+        struct Cell {
+            std::atomic<uint32> sequence;
+            T item;
+        };
+
+        Cell cells[Capacity];
+        alignas(64) std::atomic<uint32> tail{ 0 };
+        alignas(64) uint32 head = 0;
+    };
+
+} // namespace OriginsBASS
@@ -0,0 +1,124 @@
+#include "pch.h"
+#include "WorkerPool.hpp"
+#include "MusicCache.hpp"
+#include <list>
+#include <memory>
+
+namespace OriginsBASS {
+    namespace MusicCache {
+
+        typedef std::shared_ptr<const std::vector<uint8>> FileData;
+
+        struct CacheEntry {
+            std::string key;
+            FileData data;
+        };
+
+        static WorkerPool ioThread;
+        static std::mutex cacheLock;
+        // Most recently used at the front
+        static std::list<CacheEntry> entries;
+        static std::unordered_map<std::string, std::list<CacheEntry>::iterator> lookup;
+        static std::unordered_map<std::string, bool> pending;
+        static uint64 budget    = 0;
+        static uint64 usedBytes = 0;
+
+        static uint32 hits      = 0;
+        static uint32 misses    = 0;
+        static uint32 fills     = 0;
+        static uint32 evictions = 0;
+
+        static std::string MakeKey(const char* path) {
+            std::string key = path;
+            for (char& c : key)
+                c = (char)tolower((unsigned char)c);
+            return key;
+        }
+
+        // Streams hold a reference to the data so evicting it never pulls it out from under them
+        static void CALLBACK ReleaseData(HSYNC handle, DWORD channel, DWORD data, void* user) { delete static_cast<FileData*>(user); }
+
+        void PrintStats();
+
+        static void FillJob(std::string key, std::string path) {
+            std::vector<uint8> buffer;
+            FILE* file;
+            fopen_s(&file, path.c_str(), "rb");
+            if (file) {
+                fseek(file, 0, SEEK_END);
+                long size = ftell(file);
+                if (size > 0 && (uint64)size <= budget) {
+                    buffer.resize(size);
+                    fseek(file, 0, SEEK_SET);
+                    if (fread(buffer.data(), 1, buffer.size(), file) != buffer.size())
+                        buffer.clear();
+                }
+                fclose(file);
+            }
+
+            {
+                std::lock_guard<std::mutex> guard(cacheLock);
+                pending.erase(key);
+                if (buffer.empty() || lookup.count(key))
+                    return;
+
+                usedBytes += buffer.size();
+                entries.push_front({ key, std::make_shared<const std::vector<uint8>>(std::move(buffer)) });
+                lookup[key] = entries.begin();
+                ++fills;
+
+                while (usedBytes > budget && entries.size() > 1) {
+                    usedBytes -= entries.back().data->size();
+                    lookup.erase(entries.back().key);
+                    entries.pop_back();
+                    ++evictions;
+                }
+            }
+            printf("[OriginsBASS] Cached music \"%s\"\n", path.c_str());
+            PrintStats();
+        }
+
+        void Init(uint64 budgetBytes) {
+            budget = budgetBytes;
+            if (budget)
+                ioThread.Start(1);
+        }
+
+        HSTREAM CreateStream(const char* path, DWORD flags) {
+            if (!budget)
+                return 0;
+
+            std::string key = MakeKey(path);
+            FileData data;
+            {
+                std::lock_guard<std::mutex> guard(cacheLock);
+                auto it = lookup.find(key);
+                if (it == lookup.end()) {
+                    ++misses;
+                    if (!pending[key]) {
+                        pending[key] = true;
+                        std::string filePath = path;
+                        ioThread.Enqueue([key, filePath]() { FillJob(key, filePath); });
+                    }
+                    return 0;
+                }
+
+                ++hits;
+                entries.splice(entries.begin(), entries, it->second);
+                data = it->second->data;
+            }
+
+            HSTREAM stream = BASS_StreamCreateFile(true, data->data(), 0, data->size(), flags);
+            if (stream)
+                BASS_ChannelSetSync(stream, BASS_SYNC_FREE, 0, ReleaseData, new FileData(data));
+            return stream;
+        }
+
+        void PrintStats() {
+            std::lock_guard<std::mutex> guard(cacheLock);
+            printf("[OriginsBASS] Music cache: %u hits, %u misses, %u fills, %u evictions, %zu files, %llu/%llu KB\n", hits, misses, fills, evictions,
+                   entries.size(), usedBytes / 1024, budget / 1024);
+        }
+
+    } // namespace MusicCache
+} // namespace OriginsBASS
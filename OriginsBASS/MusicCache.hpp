@@ -0,0 +1,17 @@
+#pragma once
+
+namespace OriginsBASS {
+
+    // Whole music files kept in RAM, least recently used dropped first once over budget.
+    // Streams are created from the cached copy so BASS never waits on the disk mid-playback.
+    // Files are read in by a background thread the first time they're asked for.
+    namespace MusicCache {
+        void Init(uint64 budgetBytes);
+
+        // Creates a stream from the cached copy of a file. On a miss this queues the file to be read
+        // and returns 0, the caller should open it from disk this time
+        HSTREAM CreateStream(const char* path, DWORD flags);
+        void PrintStats();
+    } // namespace MusicCache
+
+} // namespace OriginsBASS
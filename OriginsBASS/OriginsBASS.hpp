@@ -15,6 +15,8 @@ typedef signed short int16;
 typedef unsigned short uint16;
 typedef signed int int32;
 typedef unsigned int uint32;
+typedef signed long long int64;
+typedef unsigned long long uint64;
 typedef uint32 bool32;
 typedef uint32 color;
 
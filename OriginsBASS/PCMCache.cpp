@@ -0,0 +1,217 @@
+#include "pch.h"
+#include "PCMCache.hpp"
+#include "Config.hpp"
+#include "Hash.hpp"
+#include <algorithm>
+
+namespace OriginsBASS {
+    namespace PCMCache {
+
+        // Bump a decoder's version when its output changes so its old files are no longer found
+        static const uint64 decoderVersions[DECODER_COUNT] = {
+            1, // DECODER_SFX
+            1, // DECODER_VGMSTREAM
+            1, // DECODER_PRERENDER
+        };
+
+        struct Entry {
+            uint64 size;
+            // FILETIME of the last use, kept on disk as the file's last write time
+            uint64 lastUse;
+            uint32 opens;
+        };
+
+        static std::mutex cacheLock;
+        static std::unordered_map<uint64, Entry> entries;
+        static std::unordered_map<const void*, uint64> views;
+        static uint64 budget    = 0;
+        static uint64 usedBytes = 0;
+
+        static uint64 Now() {
+            FILETIME now;
+            GetSystemTimeAsFileTime(&now);
+            return ((uint64)now.dwHighDateTime << 32) | now.dwLowDateTime;
+        }
+
+        static bool GetPath(uint64 key, char* out, uint32 outLen) {
+            char fileName[32];
+            sprintf_s(fileName, "pcm_%016llx.bin", key);
+            return Config::GetCachePath(out, outLen, fileName);
+        }
+
+        // Records a use in the entry and on disk so the order survives a restart
+        static void Touch(HANDLE file, Entry& entry) {
+            entry.lastUse = Now();
+            FILETIME time = { (DWORD)entry.lastUse, (DWORD)(entry.lastUse >> 32) };
+            SetFileTime(file, nullptr, nullptr, &time);
+        }
+
+        // Oldest first. Files that are mapped or that a stream has open can't be deleted and are skipped
+        static void Evict(uint64 keep) {
+            if (usedBytes <= budget)
+                return;
+
+            std::vector<std::pair<uint64, uint64>> order;
+            for (auto& entry : entries) {
+                if (entry.first != keep && !entry.second.opens)
+                    order.emplace_back(entry.second.lastUse, entry.first);
+            }
+            std::sort(order.begin(), order.end());
+
+            char path[MAX_PATH];
+            for (auto& candidate : order) {
+                if (usedBytes <= budget)
+                    break;
+                if (!GetPath(candidate.second, path, sizeof(path)) || !DeleteFileA(path))
+                    continue;
+                usedBytes -= entries[candidate.second].size;
+                entries.erase(candidate.second);
+            }
+        }
+
+        void Init(uint64 budgetBytes) {
+            std::lock_guard<std::mutex> guard(cacheLock);
+            budget = budgetBytes;
+            if (!budget)
+                return;
+
+            char pattern[MAX_PATH];
+            if (!Config::GetCachePath(pattern, sizeof(pattern), "pcm_*.bin"))
+                return;
+
+            WIN32_FIND_DATAA found;
+            HANDLE search = FindFirstFileA(pattern, &found);
+            if (search != INVALID_HANDLE_VALUE) {
+                do {
+                    uint64 key = 0;
+                    if (sscanf_s(found.cFileName, "pcm_%016llx.bin", &key) != 1)
+                        continue;
+                    Entry& entry  = entries[key];
+                    entry.size    = ((uint64)found.nFileSizeHigh << 32) | found.nFileSizeLow;
+                    entry.lastUse = ((uint64)found.ftLastWriteTime.dwHighDateTime << 32) | found.ftLastWriteTime.dwLowDateTime;
+                    entry.opens   = 0;
+                    usedBytes += entry.size;
+                } while (FindNextFileA(search, &found));
+                FindClose(search);
+            }
+
+            Evict(0);
+            printf("[OriginsBASS] PCM cache: %zu files, %llu/%llu MB\n", entries.size(), usedBytes / (1024 * 1024), budget / (1024 * 1024));
+        }
+
+        bool Enabled() { return budget != 0; }
+
+        uint64 MakeKey(uint64 sourceKey, uint32 decoder, uint64 params) {
+            uint64 parts[4] = { sourceKey, decoder, decoderVersions[decoder], params };
+            return Hash64(parts, sizeof(parts));
+        }
+
+        const void* Open(uint64 key, uint32* length) {
+            std::lock_guard<std::mutex> guard(cacheLock);
+            auto it = entries.find(key);
+            char path[MAX_PATH];
+            if (it == entries.end() || !GetPath(key, path, sizeof(path)))
+                return nullptr;
+
+            // Attribute access doesn't count against sharing, so this opens alongside other readers
+            HANDLE file = CreateFileA(path, GENERIC_READ | FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (file == INVALID_HANDLE_VALUE) {
+                usedBytes -= it->second.size;
+                entries.erase(it);
+                return nullptr;
+            }
+
+            const void* view = nullptr;
+            LARGE_INTEGER size;
+            if (GetFileSizeEx(file, &size) && size.QuadPart > 0 && size.QuadPart <= 0xFFFFFFFF) {
+                HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+                if (mapping) {
+                    // The view keeps the mapping alive on its own
+                    view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                    CloseHandle(mapping);
+                }
+            }
+            if (view) {
+                Touch(file, it->second);
+                ++it->second.opens;
+                views[view] = key;
+                *length     = (uint32)size.QuadPart;
+            }
+            CloseHandle(file);
+            return view;
+        }
+
+        void Close(const void* view) {
+            std::lock_guard<std::mutex> guard(cacheLock);
+            auto it = views.find(view);
+            if (it == views.end())
+                return;
+            UnmapViewOfFile(view);
+            auto entry = entries.find(it->second);
+            if (entry != entries.end() && entry->second.opens)
+                --entry->second.opens;
+            views.erase(it);
+        }
+
+        bool Find(uint64 key, char* out, uint32 outLen) {
+            std::lock_guard<std::mutex> guard(cacheLock);
+            auto it = entries.find(key);
+            if (it == entries.end() || !GetPath(key, out, outLen))
+                return false;
+
+            HANDLE file = CreateFileA(out, FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (file == INVALID_HANDLE_VALUE) {
+                usedBytes -= it->second.size;
+                entries.erase(it);
+                return false;
+            }
+            Touch(file, it->second);
+            CloseHandle(file);
+            return true;
+        }
+
+        bool Store(uint64 key, const void* data, uint32 length) {
+            char path[MAX_PATH];
+            if (!budget || length > budget || !GetPath(key, path, sizeof(path)))
+                return false;
+
+            // Written under a name of its own first, so neither a crash nor another thread storing the same key
+            // ever leaves a half written file under the real name
+            char tempPath[MAX_PATH];
+            sprintf_s(tempPath, "%s.%lu.tmp", path, GetCurrentThreadId());
+            HANDLE file = CreateFileA(tempPath, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (file == INVALID_HANDLE_VALUE)
+                return false;
+            DWORD bytesWritten = 0;
+            bool written       = WriteFile(file, data, length, &bytesWritten, nullptr) && bytesWritten == length;
+            CloseHandle(file);
+            if (!written) {
+                DeleteFileA(tempPath);
+                return false;
+            }
+            return StoreFile(key, tempPath);
+        }
+
+        bool StoreFile(uint64 key, const char* tempPath) {
+            char path[MAX_PATH];
+            WIN32_FILE_ATTRIBUTE_DATA attributes;
+            if (!budget || !GetPath(key, path, sizeof(path)) || !GetFileAttributesExA(tempPath, GetFileExInfoStandard, &attributes)) {
+                DeleteFileA(tempPath);
+                return false;
+            }
+            uint64 length = ((uint64)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+
+            std::lock_guard<std::mutex> guard(cacheLock);
+            if (length > budget || entries.count(key) || !MoveFileExA(tempPath, path, MOVEFILE_REPLACE_EXISTING)) {
+                DeleteFileA(tempPath);
+                return length <= budget && entries.count(key);
+            }
+
+            entries[key] = { length, Now(), 0 };
+            usedBytes += length;
+            Evict(key);
+            return true;
+        }
+
+    } // namespace PCMCache
+} // namespace OriginsBASS
@@ -0,0 +1,38 @@
+#pragma once
+
+namespace OriginsBASS {
+
+    // Decoded audio kept in the cache folder across launches, one file per source.
+    // Files are named after a key built from the source and everything the output depends on, are memory-mapped
+    // when they're used again, and the least recently used are deleted once the folder goes over budget.
+    namespace PCMCache {
+        // What produced a cache file. Each has its own version, so changing one decoder only drops its own files
+        enum Decoders {
+            // SFX conversion at load time: decode, resample and storage format, including the vgmstream fallback
+            DECODER_SFX,
+            // Whole streams converted by BASS_VGMSTREAM_ConvertVGMStreamToWav
+            DECODER_VGMSTREAM,
+            // Music rendered at another speed by Prerender, the speed is the key's params
+            DECODER_PRERENDER,
+            DECODER_COUNT,
+        };
+
+        // Finds the files already in the cache and trims it to the budget. A budget of 0 disables the cache
+        void Init(uint64 budgetBytes);
+        bool Enabled();
+
+        // Combines a hash of the source bytes with the decoder's version and any settings the output depends on
+        uint64 MakeKey(uint64 sourceKey, uint32 decoder, uint64 params);
+
+        // Maps the cached output for a key, nullptr on a miss. Views stay valid until closed
+        const void* Open(uint64 key, uint32* length);
+        void Close(const void* view);
+        // Gives the path of the cached output for a key if there is one, for callers that open it themselves
+        bool Find(uint64 key, char* out, uint32 outLen);
+        // Writes the output for a key, evicting old files if that takes the cache over budget
+        bool Store(uint64 key, const void* data, uint32 length);
+        // Same for output already written to a file of its own, which is moved into the cache or deleted
+        bool StoreFile(uint64 key, const char* tempPath);
+    } // namespace PCMCache
+
+} // namespace OriginsBASS
@@ -0,0 +1,169 @@
+#include "pch.h"
+#include "Config.hpp"
+#include "Hash.hpp"
+#include "PCMCache.hpp"
+#include "TempoQuality.hpp"
+#include "WorkerPool.hpp"
+#include "Prerender.hpp"
+#include "WaveFile.hpp"
+#include <algorithm>
+
+namespace OriginsBASS {
+    namespace Prerender {
+
+        struct RenderEntry {
+            // Path, size and write time, so a replaced track is looked at again
+            uint64 fileKey;
+            // PCMCache key, from the track's bytes and the speed
+            uint64 cacheKey;
+            uint8 state;
+            // Voices to tell once the render is done
+            std::vector<uint32> waiting;
+        };
+
+        // Renders are slow and not urgent, one thread is enough
+        static WorkerPool renderPool;
+        static std::mutex renderLock;
+        static std::unordered_map<std::string, RenderEntry> renders;
+        static ReadyCallback readyCallback = nullptr;
+
+        static bool RenderFile(const std::string& sourcePath, float speed, const char* outPath) {
+            HSTREAM source = BASS_StreamCreateFile(false, sourcePath.c_str(), 0, 0, BASS_STREAM_DECODE);
+            if (!source)
+                return false;
+            HSTREAM tempo = BASS_FX_TempoCreate(source, BASS_STREAM_DECODE | BASS_FX_FREESOURCE);
+            if (!tempo) {
+                BASS_StreamFree(source);
+                return false;
+            }
+
+            // Nothing is waiting on this, so always render at the best quality
+            TempoQuality::ApplyTier(tempo, TempoQuality::TEMPO_QUALITY_HIGH);
+            BASS_ChannelSetAttribute(tempo, BASS_ATTRIB_TEMPO, (speed - 1.0f) * 100.0f);
+
+            BASS_CHANNELINFO info;
+            BASS_ChannelGetInfo(tempo, &info);
+            uint16 bits = (info.flags & BASS_SAMPLE_FLOAT) ? 32 : (info.flags & BASS_SAMPLE_8BITS) ? 8 : 16;
+
+            WaveHeader header = MakeWaveHeader((info.flags & BASS_SAMPLE_FLOAT) ? WAVE_FORMAT_FLOAT_TAG : WAVE_FORMAT_PCM_TAG, (uint16)info.chans, info.freq, bits, 0);
+
+            FILE* file;
+            fopen_s(&file, outPath, "wb");
+            if (!file) {
+                BASS_StreamFree(tempo);
+                return false;
+            }
+
+            bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+            std::vector<uint8> buffer(0x10000);
+            while (written) {
+                DWORD length = BASS_ChannelGetData(tempo, buffer.data(), (DWORD)buffer.size());
+                if (length == (DWORD)-1)
+                    break;
+                written = fwrite(buffer.data(), 1, length, file) == length;
+                header.dataSize += length;
+            }
+            BASS_StreamFree(tempo);
+
+            header.riffSize = sizeof(header) - 8 + header.dataSize;
+            written = written && !fseek(file, 0, SEEK_SET) && fwrite(&header, sizeof(header), 1, file) == 1;
+            fclose(file);
+
+            if (!written)
+                DeleteFileA(outPath);
+            return written;
+        }
+
+        // Runs on the render thread
+        static void RenderJob(const std::string& key, const std::string& sourcePath, float speed, uint32 speedKey, uint64 fileKey) {
+            void* data    = nullptr;
+            uint32 length = 0;
+            FILE* file;
+            fopen_s(&file, sourcePath.c_str(), "rb");
+            if (file) {
+                fseek(file, 0, SEEK_END);
+                data = malloc(length = ftell(file));
+                if (data) {
+                    fseek(file, 0, SEEK_SET);
+                    length = (uint32)fread(data, 1, length, file);
+                }
+                fclose(file);
+            }
+
+            // Keyed on the track's bytes, so a copy in another mod or a touched file is still found
+            uint64 cacheKey = data ? PCMCache::MakeKey(Hash64(data, length), PCMCache::DECODER_PRERENDER, speedKey) : 0;
+            free(data);
+
+            char cachedPath[MAX_PATH];
+            bool ready = cacheKey && PCMCache::Find(cacheKey, cachedPath, sizeof(cachedPath));
+            if (cacheKey && !ready) {
+                char fileName[32];
+                sprintf_s(fileName, "render_%016llx.tmp", cacheKey);
+                char tempPath[MAX_PATH];
+                ready = Config::GetCachePath(tempPath, sizeof(tempPath), fileName) && RenderFile(sourcePath, speed, tempPath)
+                        && PCMCache::StoreFile(cacheKey, tempPath);
+                if (ready)
+                    printf("[OriginsBASS] Rendered \"%s\" at %.2fx into the PCM cache\n", sourcePath.c_str(), speed);
+                else
+                    printf("[OriginsBASS] Failed to render \"%s\" at %.2fx\n", sourcePath.c_str(), speed);
+            }
+
+            std::vector<uint32> waiting;
+            {
+                std::lock_guard<std::mutex> guard(renderLock);
+                RenderEntry& entry = renders[key];
+                if (entry.fileKey == fileKey) {
+                    entry.cacheKey = cacheKey;
+                    entry.state    = ready ? RENDER_READY : RENDER_FAILED;
+                }
+                waiting.swap(entry.waiting);
+            }
+
+            if (ready && readyCallback) {
+                for (uint32 voice : waiting)
+                    readyCallback(voice, speed);
+            }
+        }
+
+        void SetReadyCallback(ReadyCallback callback) { readyCallback = callback; }
+
+        uint8 Find(const char* sourcePath, float speed, uint32 voice, char* out, uint32 outLen) {
+            WIN32_FILE_ATTRIBUTE_DATA attributes;
+            if (!PCMCache::Enabled() || !GetFileAttributesExA(sourcePath, GetFileExInfoStandard, &attributes))
+                return RENDER_FAILED;
+            uint64 fileKey = HashString(sourcePath);
+            fileKey        = Hash64(&attributes.ftLastWriteTime, sizeof(attributes.ftLastWriteTime), fileKey);
+            fileKey        = Hash64(&attributes.nFileSizeLow, sizeof(attributes.nFileSizeLow), fileKey);
+
+            uint32 speedKey = (uint32)(speed * 1000.0f + 0.5f);
+            char key[MAX_PATH + 16];
+            sprintf_s(key, "%s|%u", sourcePath, speedKey);
+
+            std::lock_guard<std::mutex> guard(renderLock);
+            RenderEntry& entry = renders[key];
+            if (entry.fileKey == fileKey) {
+                if (entry.state == RENDER_PENDING) {
+                    if (std::find(entry.waiting.begin(), entry.waiting.end(), voice) == entry.waiting.end())
+                        entry.waiting.push_back(voice);
+                    return RENDER_PENDING;
+                }
+                if (entry.state == RENDER_FAILED)
+                    return RENDER_FAILED;
+                if (PCMCache::Find(entry.cacheKey, out, outLen))
+                    return RENDER_READY;
+                // Evicted since, render it again
+            }
+
+            entry.fileKey = fileKey;
+            entry.state   = RENDER_PENDING;
+            entry.waiting.assign(1, voice);
+            if (!renderPool.ThreadCount())
+                renderPool.Start(1);
+            std::string jobKey  = key;
+            std::string jobPath = sourcePath;
+            renderPool.Enqueue([jobKey, jobPath, speed, speedKey, fileKey]() { RenderJob(jobKey, jobPath, speed, speedKey, fileKey); });
+            return RENDER_PENDING;
+        }
+
+    } // namespace Prerender
+} // namespace OriginsBASS
@@ -0,0 +1,21 @@
+#pragma once
+
+namespace OriginsBASS {
+
+    // Time-stretched copies of music tracks, rendered once in the background and kept in the PCM cache.
+    // A voice that needs a track at another speed can then play the rendered file directly
+    // instead of running the tempo processor for as long as the speed lasts.
+    namespace Prerender {
+        enum RenderStates { RENDER_PENDING, RENDER_READY, RENDER_FAILED };
+
+        // Called on the render thread for each voice that was waiting on a render once it's ready
+        typedef void (*ReadyCallback)(uint32 voice, float speed);
+        void SetReadyCallback(ReadyCallback callback);
+
+        // Gets the rendered file for a track at a speed. If there isn't one yet a render is started in the background,
+        // RENDER_PENDING is returned and voice is passed to the ready callback when it's done.
+        // The caller should use the tempo processor until then
+        uint8 Find(const char* sourcePath, float speed, uint32 voice, char* out, uint32 outLen);
+    } // namespace Prerender
+
+} // namespace OriginsBASS
@@ -0,0 +1,107 @@
+#include "pch.h"
+#include "Resampler.hpp"
+#include <cmath>
+#include <xmmintrin.h>
+
+namespace OriginsBASS {
+    namespace Resampler {
+
+        // Taps per phase, a multiple of 4 for the SSE loop
+        const uint32 FILTER_TAPS = 32;
+        // Rates whose reduced ratio needs more phases than this are rounded to the nearest ratio that doesn't
+        const uint32 MAX_PHASES  = 4096;
+        const double KAISER_BETA = 8.0;
+        // Passband edge as a share of the lower Nyquist frequency
+        const double CUTOFF      = 0.95;
+        const double PI          = 3.14159265358979323846;
+
+        static uint32 Gcd(uint32 a, uint32 b) {
+            while (b) {
+                uint32 t = a % b;
+                a        = b;
+                b        = t;
+            }
+            return a;
+        }
+
+        // Zeroth order modified Bessel function, for the Kaiser window
+        static double BesselI0(double x) {
+            double sum = 1.0, term = 1.0;
+            for (int32 k = 1; k < 32; ++k) {
+                term *= (x / (2.0 * k)) * (x / (2.0 * k));
+                sum += term;
+            }
+            return sum;
+        }
+
+        // One row of FILTER_TAPS coefficients per phase, each row normalised to unity gain
+        static void BuildTable(std::vector<float>& table, uint32 phases, double cutoff) {
+            table.resize((size_t)phases * FILTER_TAPS);
+            const double half = FILTER_TAPS / 2.0;
+            const double norm = BesselI0(KAISER_BETA);
+            for (uint32 p = 0; p < phases; ++p) {
+                float* row = &table[(size_t)p * FILTER_TAPS];
+                double sum = 0.0;
+                for (uint32 k = 0; k < FILTER_TAPS; ++k) {
+                    // Distance from the output sample to input tap k
+                    double x      = (double)k - (half - 1.0) - (double)p / phases;
+                    double sinc   = x == 0.0 ? 1.0 : sin(PI * x * cutoff) / (PI * x * cutoff);
+                    double w      = x / half;
+                    double window = fabs(w) >= 1.0 ? 0.0 : BesselI0(KAISER_BETA * sqrt(1.0 - w * w)) / norm;
+                    row[k]        = (float)(sinc * window);
+                    sum += row[k];
+                }
+                for (uint32 k = 0; k < FILTER_TAPS; ++k)
+                    row[k] = (float)(row[k] / sum);
+            }
+        }
+
+        static inline float DotTaps(const float* x, const float* h) {
+            __m128 acc = _mm_setzero_ps();
+            for (uint32 k = 0; k < FILTER_TAPS; k += 4)
+                acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(x + k), _mm_loadu_ps(h + k)));
+            acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+            acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+            return _mm_cvtss_f32(acc);
+        }
+
+        void Convert(const float* input, uint32 frames, uint32 channels, uint32 inRate, uint32 outRate, std::vector<float>& output) {
+            if (inRate == outRate || !frames || !channels) {
+                output.assign(input, input + (size_t)frames * channels);
+                return;
+            }
+
+            // Output sample n sits at input position n * step / phases
+            uint32 divisor = Gcd(inRate, outRate);
+            uint64 phases  = outRate / divisor;
+            uint64 step    = inRate / divisor;
+            if (phases > MAX_PHASES) {
+                step   = (uint64)((double)step * MAX_PHASES / phases + 0.5);
+                phases = MAX_PHASES;
+            }
+
+            std::vector<float> table;
+            BuildTable(table, (uint32)phases, CUTOFF * (std::min)(1.0, (double)outRate / inRate));
+
+            uint32 outFrames = (uint32)((uint64)frames * phases / step);
+            output.resize((size_t)outFrames * channels);
+
+            // One padded plane per channel so every tap window is in bounds
+            const uint32 pad = FILTER_TAPS;
+            std::vector<float> plane((size_t)frames + pad * 2);
+            for (uint32 c = 0; c < channels; ++c) {
+                for (uint32 i = 0; i < frames; ++i)
+                    plane[pad + i] = input[(size_t)i * channels + c];
+
+                uint64 position = 0;
+                for (uint32 n = 0; n < outFrames; ++n, position += step) {
+                    uint64 index = position / phases;
+                    uint32 phase = (uint32)(position % phases);
+                    const float* x = &plane[pad + index - (FILTER_TAPS / 2 - 1)];
+                    output[(size_t)n * channels + c] = DotTaps(x, &table[(size_t)phase * FILTER_TAPS]);
+                }
+            }
+        }
+
+    } // namespace Resampler
+} // namespace OriginsBASS
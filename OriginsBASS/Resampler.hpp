@@ -0,0 +1,12 @@
+#pragma once
+
+namespace OriginsBASS {
+
+    // Offline sample rate conversion for audio that is converted once, not while it plays.
+    // Polyphase windowed sinc with an exact phase for every output sample whenever the ratio allows it.
+    namespace Resampler {
+        // Converts interleaved float audio. output is resized to fit
+        void Convert(const float* input, uint32 frames, uint32 channels, uint32 inRate, uint32 outRate, std::vector<float>& output);
+    } // namespace Resampler
+
+} // namespace OriginsBASS
@@ -0,0 +1,127 @@
+#include "pch.h"
+#include "SFXPool.hpp"
+#include "Config.hpp"
+#include "PCMCache.hpp"
+
+namespace OriginsBASS {
+    namespace SFXPool {
+
+        struct Entry {
+            Buffer buffer;
+            uint32 refs;
+            // Copy of the file bytes the buffer was made from. nullptr when the buffer is the file itself,
+            // or when the copy couldn't be made, in which case the buffer is never shared
+            void* source;
+            uint32 sourceLength;
+        };
+
+        static std::mutex poolLock;
+        // Content that collides on the hash gets an entry of its own under the same key
+        static std::unordered_multimap<uint64, Entry> entries;
+        static std::unordered_map<const void*, uint64> keys;
+
+        static void FreeBuffer(const Buffer& buffer) {
+            if (buffer.mapped)
+                PCMCache::Close(buffer.data);
+            else
+                free(buffer.data);
+        }
+
+        static bool SameSource(const Entry& entry, const void* source, uint32 sourceLength) {
+            if (entry.source)
+                return entry.sourceLength == sourceLength && !memcmp(entry.source, source, sourceLength);
+            // Only a buffer kept in File format is the file itself, converted ones always have their copy
+            return entry.buffer.storage == Config::SFX_STORAGE_FILE && entry.buffer.length == sourceLength
+                   && !memcmp(entry.buffer.data, source, sourceLength);
+        }
+
+        // Called with poolLock held
+        static Entry* FindSource(uint64 key, const void* source, uint32 sourceLength) {
+            auto range = entries.equal_range(key);
+            for (auto it = range.first; it != range.second; ++it) {
+                if (SameSource(it->second, source, sourceLength))
+                    return &it->second;
+            }
+            return nullptr;
+        }
+
+        // Called with poolLock held
+        static std::unordered_multimap<uint64, Entry>::iterator FindBuffer(const void* data) {
+            auto key = keys.find(data);
+            if (key == keys.end())
+                return entries.end();
+            auto range = entries.equal_range(key->second);
+            for (auto it = range.first; it != range.second; ++it) {
+                if (it->second.buffer.data == data)
+                    return it;
+            }
+            return entries.end();
+        }
+
+        bool Find(uint64 key, const void* source, uint32 sourceLength, Buffer* out) {
+            std::lock_guard<std::mutex> guard(poolLock);
+            Entry* entry = FindSource(key, source, sourceLength);
+            if (!entry)
+                return false;
+            ++entry->refs;
+            *out = entry->buffer;
+            return true;
+        }
+
+        Buffer Add(uint64 key, const Buffer& buffer, const void* source, uint32 sourceLength) {
+            std::lock_guard<std::mutex> guard(poolLock);
+            if (Entry* entry = FindSource(key, source, sourceLength)) {
+                FreeBuffer(buffer);
+                ++entry->refs;
+                return entry->buffer;
+            }
+
+            Entry entry{ buffer, 1, nullptr, 0 };
+            if (source != buffer.data && (entry.source = malloc(sourceLength))) {
+                memcpy(entry.source, source, sourceLength);
+                entry.sourceLength = sourceLength;
+            }
+            entries.emplace(key, entry);
+            keys[buffer.data] = key;
+            return buffer;
+        }
+
+        bool Acquire(const void* data, Buffer* out) {
+            std::lock_guard<std::mutex> guard(poolLock);
+            auto it = FindBuffer(data);
+            if (it == entries.end())
+                return false;
+            ++it->second.refs;
+            *out = it->second.buffer;
+            return true;
+        }
+
+        void Release(const void* data) {
+            std::lock_guard<std::mutex> guard(poolLock);
+            auto it = FindBuffer(data);
+            if (it == entries.end())
+                return;
+            if (--it->second.refs)
+                return;
+            FreeBuffer(it->second.buffer);
+            free(it->second.source);
+            entries.erase(it);
+            keys.erase(data);
+        }
+
+        static void CALLBACK ReleaseHeld(HSYNC handle, DWORD channel, DWORD data, void* user) { Release(user); }
+
+        void Hold(HSTREAM stream, const void* data) {
+            {
+                std::lock_guard<std::mutex> guard(poolLock);
+                auto it = FindBuffer(data);
+                if (it == entries.end())
+                    return;
+                ++it->second.refs;
+            }
+            if (!BASS_ChannelSetSync(stream, BASS_SYNC_FREE, 0, ReleaseHeld, const_cast<void*>(data)))
+                Release(data);
+        }
+
+    } // namespace SFXPool
+} // namespace OriginsBASS
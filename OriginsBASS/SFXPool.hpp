@@ -0,0 +1,32 @@
+#pragma once
+
+namespace OriginsBASS {
+
+    // SFX buffers shared between every slot loaded from identical file content.
+    // Buffers are keyed by a hash of the file bytes and the storage format, and freed when the last slot
+    // or stream that references them lets go, so reloading a slot never frees audio a voice is still playing.
+    // A hash match is only shared once the file bytes compare equal, so a collision never plays the wrong sound.
+    namespace SFXPool {
+        struct Buffer {
+            void* data;
+            uint32 length;
+            // A Config::SFXStorageFormats format
+            uint8 storage;
+            // A PCMCache view rather than malloc'd memory
+            bool mapped;
+        };
+
+        // Takes a reference on the buffer made from the same file bytes, if there is one
+        bool Find(uint64 key, const void* source, uint32 sourceLength, Buffer* out);
+        // Adds a malloc'd or mapped buffer made from the given file bytes with one reference. If another loader added
+        // the same content first, frees this one and returns a reference to that instead.
+        // Keeps a copy of the file bytes to compare against, unless they are the buffer itself
+        Buffer Add(uint64 key, const Buffer& buffer, const void* source, uint32 sourceLength);
+        // Takes a reference on a buffer already in the pool. Fails once its last reference is gone
+        bool Acquire(const void* data, Buffer* out);
+        void Release(const void* data);
+        // Keeps a buffer alive until the stream playing from it is freed. The caller must hold a reference
+        void Hold(HSTREAM stream, const void* data);
+    } // namespace SFXPool
+
+} // namespace OriginsBASS
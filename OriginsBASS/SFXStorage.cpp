@@ -0,0 +1,407 @@
+#include "pch.h"
+#include "SFXStorage.hpp"
+#include "Config.hpp"
+#include "WaveFile.hpp"
+#include <chrono>
+#include <cmath>
+#include <emmintrin.h>
+
+namespace OriginsBASS {
+    namespace SFXStorage {
+
+        const uint32 ADPCM_MAGIC       = 0x4D435041; // "APCM"
+        const uint32 ADPCM_LANE_FRAMES = 256;
+        // Each lane starts with the decoder state, then two samples per byte, low nibble first
+        const uint32 ADPCM_LANE_BYTES  = 4 + ADPCM_LANE_FRAMES / 2;
+
+        struct ADPCMHeader {
+            uint32 magic;
+            uint32 sampleRate;
+            uint32 frames;
+            uint32 channels;
+            uint32 blocks;
+        };
+
+        struct LaneState {
+            int16 predictor;
+            uint8 index;
+            uint8 reserved;
+        };
+
+        static const int32 stepTable[89] = {
+            7,     8,     9,     10,    11,    12,    13,    14,    16,    17,    19,    21,    23,    25,    28,    31,    34,    37,
+            41,    45,    50,    55,    60,    66,    73,    80,    88,    97,    107,   118,   130,   143,   157,   173,   190,   209,
+            230,   253,   279,   307,   337,   371,   408,   449,   494,   544,   598,   658,   724,   796,   876,   963,   1060,  1166,
+            1282,  1411,  1552,  1707,  1878,  2066,  2272,  2499,  2749,  3024,  3327,  3660,  4026,  4428,  4871,  5358,  5894,  6484,
+            7132,  7845,  8630,  9493,  10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767,
+        };
+        static const int32 indexTable[8] = { -1, -1, -1, -1, 2, 4, 6, 8 };
+
+        // Voices that expanded an ADPCM image
+        static std::atomic<uint32> decodeCount{ 0 };
+        static std::atomic<uint64> decodeMicros{ 0 };
+        static std::atomic<uint64> decodedAudioMicros{ 0 };
+
+        // Totals from Measure
+        static std::mutex measureLock;
+        static uint32 measuredSounds    = 0;
+        static uint64 measuredPCM16     = 0;
+        static uint64 measuredADPCM     = 0;
+        static uint64 measuredMicros    = 0;
+        static uint64 measuredAudio     = 0;
+        static double measuredSignal    = 0.0;
+        static double measuredError     = 0.0;
+
+        static uint64 MicrosSince(std::chrono::high_resolution_clock::time_point start) {
+            return (uint64)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+        }
+
+        static uint32 ADPCMSize(uint32 frames, uint32 channels) {
+            uint32 blocks = (frames + ADPCM_LANE_FRAMES - 1) / ADPCM_LANE_FRAMES;
+            return sizeof(ADPCMHeader) + blocks * channels * ADPCM_LANE_BYTES;
+        }
+
+        uint32 PCM16Size(uint32 frames, uint32 channels) { return sizeof(WaveHeader) + frames * channels * sizeof(int16); }
+
+        static void ToPCM16(const float* samples, uint32 count, int16* out) {
+            for (uint32 i = 0; i < count; ++i) {
+                float s = samples[i] * 32768.0f;
+                s       = (std::min)((std::max)(s, -32768.0f), 32767.0f);
+                out[i]  = (int16)lrintf(s);
+            }
+        }
+
+        // Lanes are encoded one after another per channel, so each lane starts with the state the previous one ended on
+        // and decoding lanes separately gives exactly what one long decode would
+        static void EncodeADPCM(const int16* samples, uint32 frames, uint32 channels, uint8* lanes) {
+            uint32 blocks = (frames + ADPCM_LANE_FRAMES - 1) / ADPCM_LANE_FRAMES;
+            for (uint32 c = 0; c < channels; ++c) {
+                int32 predictor = 0;
+                int32 index     = 0;
+                for (uint32 b = 0; b < blocks; ++b) {
+                    uint8* lane = lanes + (b * channels + c) * ADPCM_LANE_BYTES;
+                    LaneState state{ (int16)predictor, (uint8)index, 0 };
+                    memcpy(lane, &state, sizeof(state));
+                    uint8* codes = lane + sizeof(state);
+                    memset(codes, 0, ADPCM_LANE_FRAMES / 2);
+
+                    for (uint32 n = 0; n < ADPCM_LANE_FRAMES; ++n) {
+                        uint32 frame = b * ADPCM_LANE_FRAMES + n;
+                        // The tail of the last lane holds silence
+                        int32 sample = frame < frames ? samples[frame * channels + c] : 0;
+                        int32 step   = stepTable[index];
+                        int32 diff   = sample - predictor;
+                        uint8 code   = 0;
+                        if (diff < 0) {
+                            code = 8;
+                            diff = -diff;
+                        }
+
+                        int32 delta = step >> 3;
+                        if (diff >= step) {
+                            code |= 4;
+                            diff -= step;
+                            delta += step;
+                        }
+                        step >>= 1;
+                        if (diff >= step) {
+                            code |= 2;
+                            diff -= step;
+                            delta += step;
+                        }
+                        step >>= 1;
+                        if (diff >= step) {
+                            code |= 1;
+                            delta += step;
+                        }
+
+                        predictor += (code & 8) ? -delta : delta;
+                        predictor = (std::min)((std::max)(predictor, -32768), 32767);
+                        index     = (std::min)((std::max)(index + indexTable[code & 7], 0), 88);
+                        codes[n >> 1] |= code << ((n & 1) * 4);
+                    }
+                }
+            }
+        }
+
+        static void DecodeLane(const uint8* lane, int16* out, uint32 stride) {
+            LaneState state;
+            memcpy(&state, lane, sizeof(state));
+            const uint8* codes = lane + sizeof(state);
+            int32 predictor    = state.predictor;
+            int32 index        = state.index;
+
+            for (uint32 n = 0; n < ADPCM_LANE_FRAMES; ++n) {
+                int32 code  = (codes[n >> 1] >> ((n & 1) * 4)) & 0xF;
+                int32 step  = stepTable[index];
+                int32 delta = step >> 3;
+                if (code & 4)
+                    delta += step;
+                if (code & 2)
+                    delta += step >> 1;
+                if (code & 1)
+                    delta += step >> 2;
+                predictor += (code & 8) ? -delta : delta;
+                predictor = (std::min)((std::max)(predictor, -32768), 32767);
+                index     = (std::min)((std::max)(index + indexTable[code & 7], 0), 88);
+                out[n * stride] = (int16)predictor;
+            }
+        }
+
+        // The same steps as DecodeLane with one lane in each 32-bit element. The step table lookup is the only part
+        // left scalar, codes are read eight samples at a time
+        static void DecodeLanes4(const uint8* const lanes[4], int16* const out[4], uint32 stride) {
+            alignas(16) int32 indices[4];
+            LaneState states[4];
+            for (uint32 l = 0; l < 4; ++l)
+                memcpy(&states[l], lanes[l], sizeof(LaneState));
+
+            __m128i predictor = _mm_set_epi32(states[3].predictor, states[2].predictor, states[1].predictor, states[0].predictor);
+            __m128i index     = _mm_set_epi32(states[3].index, states[2].index, states[1].index, states[0].index);
+            const __m128i one    = _mm_set1_epi32(1);
+            const __m128i two    = _mm_set1_epi32(2);
+            const __m128i three  = _mm_set1_epi32(3);
+            const __m128i four   = _mm_set1_epi32(4);
+            const __m128i eight  = _mm_set1_epi32(8);
+            const __m128i nibble = _mm_set1_epi32(0xF);
+            const __m128i maxIdx = _mm_set1_epi32(88);
+            const __m128i zero   = _mm_setzero_si128();
+
+            for (uint32 n = 0; n < ADPCM_LANE_FRAMES; n += 8) {
+                uint32 words[4];
+                for (uint32 l = 0; l < 4; ++l)
+                    memcpy(&words[l], lanes[l] + sizeof(LaneState) + n / 2, sizeof(uint32));
+                __m128i packedCodes = _mm_set_epi32(words[3], words[2], words[1], words[0]);
+
+                for (uint32 k = 0; k < 8; ++k) {
+                    __m128i code = _mm_and_si128(packedCodes, nibble);
+                    packedCodes  = _mm_srli_epi32(packedCodes, 4);
+
+                    _mm_store_si128(reinterpret_cast<__m128i*>(indices), index);
+                    __m128i step = _mm_set_epi32(stepTable[indices[3]], stepTable[indices[2]], stepTable[indices[1]], stepTable[indices[0]]);
+
+                    __m128i delta = _mm_srai_epi32(step, 3);
+                    delta = _mm_add_epi32(delta, _mm_and_si128(_mm_cmpeq_epi32(_mm_and_si128(code, four), four), step));
+                    delta = _mm_add_epi32(delta, _mm_and_si128(_mm_cmpeq_epi32(_mm_and_si128(code, two), two), _mm_srai_epi32(step, 1)));
+                    delta = _mm_add_epi32(delta, _mm_and_si128(_mm_cmpeq_epi32(_mm_and_si128(code, one), one), _mm_srai_epi32(step, 2)));
+                    // Negate where the sign bit is set
+                    __m128i sign = _mm_cmpeq_epi32(_mm_and_si128(code, eight), eight);
+                    delta        = _mm_sub_epi32(_mm_xor_si128(delta, sign), sign);
+
+                    // Saturating to 16 bits clamps the predictor, the 16-bit copy is also what gets written out
+                    __m128i samples = _mm_packs_epi32(_mm_add_epi32(predictor, delta), zero);
+                    predictor       = _mm_srai_epi32(_mm_unpacklo_epi16(samples, samples), 16);
+
+                    // -1 for codes 0-3, (code - 3) * 2 for 4-7
+                    __m128i low    = _mm_andnot_si128(eight, code);
+                    __m128i upper  = _mm_cmpgt_epi32(low, three);
+                    __m128i adjust = _mm_or_si128(_mm_and_si128(upper, _mm_slli_epi32(_mm_sub_epi32(low, three), 1)), _mm_andnot_si128(upper, _mm_set1_epi32(-1)));
+                    // Indices stay small, so the 16-bit min/max clamp them
+                    index = _mm_min_epi16(_mm_max_epi16(_mm_add_epi32(index, adjust), zero), maxIdx);
+
+                    uint32 at = (n + k) * stride;
+                    out[0][at] = (int16)_mm_extract_epi16(samples, 0);
+                    out[1][at] = (int16)_mm_extract_epi16(samples, 1);
+                    out[2][at] = (int16)_mm_extract_epi16(samples, 2);
+                    out[3][at] = (int16)_mm_extract_epi16(samples, 3);
+                }
+            }
+        }
+
+        // Fills out with a run of blocks, interleaved. The last block includes its silent tail
+        static void DecodeADPCM(const ADPCMHeader* header, uint32 firstBlock, uint32 blockCount, int16* out) {
+            uint32 channels    = header->channels;
+            const uint8* lanes = reinterpret_cast<const uint8*>(header + 1) + (size_t)firstBlock * channels * ADPCM_LANE_BYTES;
+            uint32 laneCount   = blockCount * channels;
+
+            auto laneOutput = [&](uint32 lane) { return out + (lane / channels) * ADPCM_LANE_FRAMES * channels + lane % channels; };
+
+            uint32 lane = 0;
+            for (; lane + 4 <= laneCount; lane += 4) {
+                const uint8* group[4] = { lanes + lane * ADPCM_LANE_BYTES, lanes + (lane + 1) * ADPCM_LANE_BYTES, lanes + (lane + 2) * ADPCM_LANE_BYTES,
+                                          lanes + (lane + 3) * ADPCM_LANE_BYTES };
+                int16* groupOut[4]    = { laneOutput(lane), laneOutput(lane + 1), laneOutput(lane + 2), laneOutput(lane + 3) };
+                DecodeLanes4(group, groupOut, channels);
+            }
+            for (; lane < laneCount; ++lane)
+                DecodeLane(lanes + lane * ADPCM_LANE_BYTES, laneOutput(lane), channels);
+        }
+
+        void* Store(const float* samples, uint32 frames, uint32 channels, uint32 rate, uint8 format, uint32* length) {
+            std::vector<int16> pcm((size_t)frames * channels);
+            ToPCM16(samples, (uint32)pcm.size(), pcm.data());
+
+            if (format == Config::SFX_STORAGE_ADPCM) {
+                uint32 size = ADPCMSize(frames, channels);
+                uint8* image = static_cast<uint8*>(malloc(size));
+                if (!image)
+                    return nullptr;
+                ADPCMHeader header{ ADPCM_MAGIC, rate, frames, channels, (frames + ADPCM_LANE_FRAMES - 1) / ADPCM_LANE_FRAMES };
+                memcpy(image, &header, sizeof(header));
+                EncodeADPCM(pcm.data(), frames, channels, image + sizeof(header));
+                *length = size;
+                return image;
+            }
+
+            uint32 dataSize   = frames * channels * sizeof(int16);
+            WaveHeader header = MakeWaveHeader(WAVE_FORMAT_PCM_TAG, (uint16)channels, rate, 16, dataSize);
+            uint8* image      = static_cast<uint8*>(malloc(sizeof(header) + dataSize));
+            if (!image)
+                return nullptr;
+            memcpy(image, &header, sizeof(header));
+            memcpy(image + sizeof(header), pcm.data(), dataSize);
+            *length = sizeof(header) + dataSize;
+            return image;
+        }
+
+        uint8 FormatOf(const void* image, uint32 length) {
+            const ADPCMHeader* header = static_cast<const ADPCMHeader*>(image);
+            return length >= sizeof(ADPCMHeader) && header->magic == ADPCM_MAGIC ? Config::SFX_STORAGE_ADPCM : Config::SFX_STORAGE_PCM16;
+        }
+
+        // A voice reads an ADPCM image as a 16-bit WAV file that's decoded a few blocks at a time as BASS asks for it,
+        // so starting a voice costs no more than its first read. Seeks and loops just move the read position
+        const uint32 ADPCM_READ_BLOCKS = 8;
+
+        struct ADPCMReader {
+            const ADPCMHeader* header;
+            WaveHeader wave;
+            uint64 position;
+            // First block in decoded, or UINT32_MAX before anything is decoded
+            uint32 decodedBlock;
+            std::vector<int16> decoded;
+        };
+
+        static void CALLBACK CloseADPCM(void* user) { delete static_cast<ADPCMReader*>(user); }
+
+        static QWORD CALLBACK LengthADPCM(void* user) {
+            ADPCMReader* reader = static_cast<ADPCMReader*>(user);
+            return sizeof(WaveHeader) + reader->wave.dataSize;
+        }
+
+        static DWORD CALLBACK ReadADPCM(void* buffer, DWORD length, void* user) {
+            ADPCMReader* reader       = static_cast<ADPCMReader*>(user);
+            const ADPCMHeader* header = reader->header;
+            uint8* out                = static_cast<uint8*>(buffer);
+            uint64 total              = sizeof(WaveHeader) + reader->wave.dataSize;
+            uint32 blockBytes         = ADPCM_LANE_FRAMES * header->channels * sizeof(int16);
+
+            DWORD done = 0;
+            while (done < length && reader->position < total) {
+                uint64 count;
+                if (reader->position < sizeof(WaveHeader)) {
+                    count = (std::min)((uint64)(length - done), sizeof(WaveHeader) - reader->position);
+                    memcpy(out + done, reinterpret_cast<const uint8*>(&reader->wave) + reader->position, (size_t)count);
+                }
+                else {
+                    uint64 dataPos    = reader->position - sizeof(WaveHeader);
+                    uint32 block      = (uint32)(dataPos / blockBytes);
+                    uint32 firstBlock = block - block % ADPCM_READ_BLOCKS;
+                    if (firstBlock != reader->decodedBlock) {
+                        auto start = std::chrono::high_resolution_clock::now();
+                        uint32 blockCount = (std::min)(ADPCM_READ_BLOCKS, header->blocks - firstBlock);
+                        DecodeADPCM(header, firstBlock, blockCount, reader->decoded.data());
+                        reader->decodedBlock = firstBlock;
+                        decodeMicros.fetch_add(MicrosSince(start), std::memory_order_relaxed);
+                        decodedAudioMicros.fetch_add((uint64)blockCount * ADPCM_LANE_FRAMES * 1000000 / header->sampleRate, std::memory_order_relaxed);
+                    }
+
+                    // The data ends inside the last decoded block, so total bounds the copy
+                    uint64 offset = dataPos - (uint64)firstBlock * blockBytes;
+                    count         = (std::min)((uint64)(length - done), (std::min)((uint64)ADPCM_READ_BLOCKS * blockBytes - offset, total - reader->position));
+                    memcpy(out + done, reinterpret_cast<const uint8*>(reader->decoded.data()) + offset, (size_t)count);
+                }
+                done += (DWORD)count;
+                reader->position += count;
+            }
+            return done;
+        }
+
+        static BOOL CALLBACK SeekADPCM(QWORD offset, void* user) {
+            ADPCMReader* reader = static_cast<ADPCMReader*>(user);
+            if (offset > sizeof(WaveHeader) + reader->wave.dataSize)
+                return false;
+            reader->position = offset;
+            return true;
+        }
+
+        static BASS_FILEPROCS adpcmProcs = { CloseADPCM, LengthADPCM, ReadADPCM, SeekADPCM };
+
+        HSTREAM CreateStream(const void* image, uint32 length, DWORD flags) {
+            const ADPCMHeader* header = static_cast<const ADPCMHeader*>(image);
+            if (FormatOf(image, length) != Config::SFX_STORAGE_ADPCM)
+                return BASS_StreamCreateFile(true, image, 0, length, flags);
+
+            ADPCMReader* reader  = new ADPCMReader();
+            reader->header       = header;
+            reader->wave         = MakeWaveHeader(WAVE_FORMAT_PCM_TAG, (uint16)header->channels, header->sampleRate, 16,
+                                                  header->frames * header->channels * sizeof(int16));
+            reader->position     = 0;
+            reader->decodedBlock = UINT32_MAX;
+            reader->decoded.resize((size_t)ADPCM_READ_BLOCKS * ADPCM_LANE_FRAMES * header->channels);
+            decodeCount.fetch_add(1, std::memory_order_relaxed);
+
+            // BASS calls CloseADPCM when the stream is freed, and also when creating it fails
+            return BASS_StreamCreateFileUser(STREAMFILE_NOBUFFER, flags, &adpcmProcs, reader);
+        }
+
+        void Measure(const float* samples, uint32 frames, uint32 channels, uint32 rate) {
+            if (!frames || !channels || !rate)
+                return;
+
+            uint32 length = 0;
+            void* image   = Store(samples, frames, channels, rate, Config::SFX_STORAGE_ADPCM, &length);
+            if (!image)
+                return;
+            const ADPCMHeader* header = static_cast<const ADPCMHeader*>(image);
+
+            std::vector<int16> reference((size_t)frames * channels);
+            std::vector<int16> decoded((size_t)header->blocks * ADPCM_LANE_FRAMES * channels);
+            ToPCM16(samples, (uint32)reference.size(), reference.data());
+
+            // Best of a few runs so a preempted one doesn't count
+            uint64 best = UINT64_MAX;
+            for (int32 run = 0; run < 4; ++run) {
+                auto start = std::chrono::high_resolution_clock::now();
+                DecodeADPCM(header, 0, header->blocks, decoded.data());
+                best = (std::min)(best, MicrosSince(start));
+            }
+
+            double signal = 0.0, error = 0.0;
+            for (size_t i = 0; i < reference.size(); ++i) {
+                double diff = (double)reference[i] - decoded[i];
+                signal += (double)reference[i] * reference[i];
+                error += diff * diff;
+            }
+            free(image);
+
+            std::lock_guard<std::mutex> guard(measureLock);
+            ++measuredSounds;
+            measuredPCM16 += PCM16Size(frames, channels);
+            measuredADPCM += length;
+            measuredMicros += best;
+            measuredAudio += (uint64)frames * 1000000 / rate;
+            measuredSignal += signal;
+            measuredError += error;
+        }
+
+        void PrintStats() {
+            uint32 count = decodeCount.load(std::memory_order_relaxed);
+            uint64 audio = decodedAudioMicros.load(std::memory_order_relaxed);
+            if (count && audio)
+                printf("[OriginsBASS] ADPCM SFX: %u voices decoded, %llu us for %.1f s of audio (%.1f us per second)\n", count,
+                       decodeMicros.load(std::memory_order_relaxed), audio / 1000000.0,
+                       decodeMicros.load(std::memory_order_relaxed) * 1000000.0 / audio);
+
+            std::lock_guard<std::mutex> guard(measureLock);
+            if (!measuredSounds || !measuredAudio)
+                return;
+            double snr = measuredError > 0.0 ? 10.0 * log10(measuredSignal / measuredError) : 0.0;
+            printf("[OriginsBASS] SFX storage benchmark: %u sounds, %.1f s of audio. 16-bit %llu KB, ADPCM %llu KB (saves %llu KB, %.1f dB SNR), "
+                   "ADPCM decode %llu us (%.1f us per second)\n",
+                   measuredSounds, measuredAudio / 1000000.0, measuredPCM16 / 1024, measuredADPCM / 1024, (measuredPCM16 - measuredADPCM) / 1024, snr,
+                   measuredMicros, measuredMicros * 1000000.0 / measuredAudio);
+        }
+
+    } // namespace SFXStorage
+} // namespace OriginsBASS
@@ -0,0 +1,26 @@
+#pragma once
+
+namespace OriginsBASS {
+
+    // Compact in-memory formats for decoded SFX.
+    // 16-bit images are plain WAV files. IMA-ADPCM images hold independent 256 sample lanes, one per block and channel,
+    // and are decoded a few blocks at a time as a voice plays, four lanes at a time with SSE2.
+    namespace SFXStorage {
+        // Builds the stored image of interleaved float audio in a Config::SFXStorageFormats format other than file.
+        // Returns a malloc'd image or nullptr
+        void* Store(const float* samples, uint32 frames, uint32 channels, uint32 rate, uint8 format, uint32* length);
+        // Size Store would give a 16-bit image of this audio
+        uint32 PCM16Size(uint32 frames, uint32 channels);
+        // Format of an image Store made
+        uint8 FormatOf(const void* image, uint32 length);
+
+        // Opens a memory stream on any SFX image. ADPCM is read through file callbacks that decode it as it's played
+        HSTREAM CreateStream(const void* image, uint32 length, DWORD flags);
+
+        // Encodes and decodes audio as ADPCM without keeping it, adding to the totals PrintStats reports
+        void Measure(const float* samples, uint32 frames, uint32 channels, uint32 rate);
+        // Prints what ADPCM voices have cost to decode and, after Measure, what ADPCM would save
+        void PrintStats();
+    } // namespace SFXStorage
+
+} // namespace OriginsBASS
@@ -1,6 +1,11 @@
 #include "pch.h"
 #include "SigScan.h"
+#include "SigScanRange.h"
+#include "Config.hpp"
+#include "Hash.hpp"
 #include <Psapi.h>
+#include <emmintrin.h>
+#include <algorithm>
 #define _countof(a) (sizeof(a)/sizeof(*(a)))
 
 bool SigValid = true;
@@ -18,44 +23,499 @@ const MODULEINFO& getModuleInfo()
     return moduleInfo;
 }
 
-void* sigScan(const char* signature, const char* mask)
+static const IMAGE_NT_HEADERS* getNtHeaders()
 {
+    const uint8* base = (const uint8*)getModuleInfo().lpBaseOfDll;
+
+    const IMAGE_DOS_HEADER* dosHeader = (const IMAGE_DOS_HEADER*)base;
+    if (dosHeader->e_magic != IMAGE_DOS_SIGNATURE)
+        return nullptr;
+
+    const IMAGE_NT_HEADERS* ntHeaders = (const IMAGE_NT_HEADERS*)(base + dosHeader->e_lfanew);
+    return ntHeaders->Signature == IMAGE_NT_SIGNATURE ? ntHeaders : nullptr;
+}
+
+struct SigRegion
+{
+    const uint8* begin;
+    size_t size;
+};
+
+// Executable sections of the main module.
+// Every signature targets code, so .rdata, .data and resources are never scanned.
+static const std::vector<SigRegion>& getCodeRegions()
+{
+    static std::vector<SigRegion> regions;
+    if (!regions.empty())
+        return regions;
+
     const MODULEINFO& moduleInfo = getModuleInfo();
-    const size_t length = strlen(mask);
+    const uint8* base = (const uint8*)moduleInfo.lpBaseOfDll;
 
-    for (size_t i = 0; i < moduleInfo.SizeOfImage; i++)
+    if (const IMAGE_NT_HEADERS* ntHeaders = getNtHeaders())
     {
-        char* memory = (char*)moduleInfo.lpBaseOfDll + i;
+        const IMAGE_SECTION_HEADER* section = IMAGE_FIRST_SECTION(ntHeaders);
+        for (WORD i = 0; i < ntHeaders->FileHeader.NumberOfSections; ++i, ++section)
+        {
+            if (!(section->Characteristics & IMAGE_SCN_MEM_EXECUTE) || section->VirtualAddress >= moduleInfo.SizeOfImage)
+                continue;
+
+            size_t size = section->Misc.VirtualSize ? section->Misc.VirtualSize : section->SizeOfRawData;
+            size        = (std::min)(size, (size_t)(moduleInfo.SizeOfImage - section->VirtualAddress));
+            regions.push_back({ base + section->VirtualAddress, size });
+        }
+    }
+
+    // Headers didn't make sense, scan everything like before
+    if (regions.empty())
+        regions.push_back({ base, moduleInfo.SizeOfImage });
 
-        size_t j;
-        for (j = 0; j < length; j++)
-            if (mask[j] != '?' && signature[j] != memory[j])
-                break;
+    return regions;
+}
+
+// Every SIG_SCAN links itself into a list so all of them can be resolved in one pass
+struct SigDefinition
+{
+    const char* name;
+    const char** data;
+    int count;
+    void** address;
+    int alternative;
+    SigDefinition* next;
+};
 
-        if (j == length)
-            return memory;
+struct SigPattern
+{
+    SigDefinition* owner;
+    int alternative;
+    const char* signature;
+    const char* mask;
+    size_t length;
+    size_t anchorOffset;
+    size_t anchorLength;
+    uint16 key;
+    const uint8* firstMatch;
+    uint32 matchCount;
+};
+
+static inline uint16 sigKey(const uint8* p, size_t anchorLength)
+{
+    return anchorLength >= 2 ? (uint16)(p[0] | (p[1] << 8)) : p[0];
+}
+
+// Multi-pattern pass.
+// Every pattern is reduced to the first two bytes of its anchor (one byte for single-byte anchors).
+// Those keys are compared 16 positions at a time, and only positions matching one of them are
+// looked up in the key table and given a full masked compare.
+// Only matches starting in the first ownedSize bytes are counted.
+static void sigScanPatterns(const uint8* begin, size_t size, size_t ownedSize, std::vector<SigPattern>& patterns)
+{
+    uint64 filterPair[0x10000 / 64] = {};
+    uint64 filterByte[0x100 / 64]   = {};
+
+    // Sorted by key so candidates for a position are one contiguous range.
+    // Single-byte keys are stored as 0-0xFF, byte pairs as 0x100 + pair.
+    std::vector<std::pair<uint32, uint32>> lookup;
+    for (uint32 p = 0; p < patterns.size(); ++p)
+    {
+        SigPattern& pattern = patterns[p];
+        if (!pattern.anchorLength)
+            continue;
+        if (pattern.anchorLength >= 2)
+        {
+            filterPair[pattern.key >> 6] |= 1ull << (pattern.key & 63);
+            lookup.push_back({ 0x100 + (uint32)pattern.key, p });
+        }
+        else
+        {
+            filterByte[pattern.key >> 6] |= 1ull << (pattern.key & 63);
+            lookup.push_back({ (uint32)pattern.key, p });
+        }
+    }
+    std::sort(lookup.begin(), lookup.end());
+    if (lookup.empty())
+        return;
+
+    auto check = [&](size_t anchorPos, uint32 key) {
+        auto it = std::lower_bound(lookup.begin(), lookup.end(), std::make_pair(key, 0u));
+        for (; it != lookup.end() && it->first == key; ++it)
+        {
+            SigPattern& pattern = patterns[it->second];
+            if (anchorPos < pattern.anchorOffset)
+                continue;
+            const size_t start = anchorPos - pattern.anchorOffset;
+            if (start >= ownedSize || start + pattern.length > size || !compareMasked(begin + start, pattern.signature, pattern.mask, pattern.length))
+                continue;
+            if (!pattern.matchCount++)
+                pattern.firstMatch = begin + start;
+        }
+    };
+
+    auto checkPosition = [&](size_t i) {
+        const uint8 b = begin[i];
+        if (filterByte[b >> 6] & (1ull << (b & 63)))
+            check(i, b);
+        if (i + 1 < size)
+        {
+            const uint16 pair = (uint16)(b | (begin[i + 1] << 8));
+            if (filterPair[pair >> 6] & (1ull << (pair & 63)))
+                check(i, 0x100 + (uint32)pair);
+        }
+    };
+
+    // Distinct keys for the vector filter. Too many and the bitmap alone is faster.
+    const size_t maxVectorKeys = 24;
+    std::vector<__m128i> keyFirst, keySecond;
+    std::vector<bool> keySingle;
+    for (size_t k = 0; k < lookup.size(); ++k)
+    {
+        if (k && lookup[k].first == lookup[k - 1].first)
+            continue;
+        const uint32 key = lookup[k].first;
+        keyFirst.push_back(_mm_set1_epi8((char)(key >= 0x100 ? (key - 0x100) & 0xFF : key)));
+        keySecond.push_back(_mm_set1_epi8((char)(key >= 0x100 ? (key - 0x100) >> 8 : 0)));
+        keySingle.push_back(key < 0x100);
     }
 
-    return nullptr;
+    size_t i = 0;
+    if (keyFirst.size() <= maxVectorKeys)
+    {
+        for (; i + 17 <= size; i += 16)
+        {
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin + i));
+            const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin + i + 1));
+            __m128i hits    = _mm_setzero_si128();
+            for (size_t k = 0; k < keyFirst.size(); ++k)
+            {
+                const __m128i first = _mm_cmpeq_epi8(a, keyFirst[k]);
+                hits = _mm_or_si128(hits, keySingle[k] ? first : _mm_and_si128(first, _mm_cmpeq_epi8(b, keySecond[k])));
+            }
+
+            for (uint32 mask = (uint32)_mm_movemask_epi8(hits); mask; mask &= mask - 1)
+                checkPosition(i + lowestBit(mask));
+        }
+    }
+
+    for (; i < size; ++i)
+        checkPosition(i);
 }
 
-#define SIG_SCAN(x, ...) \
+// Registry
+// HOOK addresses are resolved during static init of other files, so the list has to be constant-initialized.
+// Each SIG_SCAN specializes SigChain for its __COUNTER__ value to point at its definition, and links to whatever
+// the chain held just before it. Counter values used by anything else fall through to the previous link.
+enum { SIG_CHAIN_BASE = __COUNTER__ };
+
+template<int N>
+struct SigChain
+{
+    static constexpr SigDefinition* head = SigChain<N - 1>::head;
+};
+
+template<>
+struct SigChain<SIG_CHAIN_BASE>
+{
+    static constexpr SigDefinition* head = nullptr;
+};
+
+#define SIG_SCAN(x, ...) SIG_SCAN_AT(x, __COUNTER__, __VA_ARGS__)
+#define SIG_SCAN_AT(x, n, ...) \
     void* x##Addr; \
+    static const char* x##Data[] = { __VA_ARGS__ }; \
+    static SigDefinition x##Definition = { #x, x##Data, _countof(x##Data), &x##Addr, 0, SigChain<n - 1>::head }; \
+    template<> \
+    struct SigChain<n> \
+    { \
+        static constexpr SigDefinition* head = &x##Definition; \
+    }; \
     void* x() \
     { \
-        static const char* x##Data[] = { __VA_ARGS__ }; \
         if (!x##Addr) \
-        { \
-            for (int i = 0; i < _countof(x##Data); i += 2) \
-            { \
-                x##Addr = sigScan(x##Data[i], x##Data[i + 1]); \
-                if (x##Addr) \
-                    return x##Addr; \
-                } \
-            SigValid = false; \
-        } \
+            SigResolveAll(); \
         return x##Addr; \
     }
 
 // Scans
 SIG_SCAN(SigLinkGameLogicDLL, "\x48\x83\xEC\x78\x4C\x8B\x09\x4C\x8B\x05\x00\x00\x00\x00\x8B\x15\x00\x00\x00\x00\x4C\x89\x0D\x00\x00\x00\x00\x48\x8B\x41\x68\x48\x89\x05\x00\x00\x00\x00\x48\x8B", "xxxxxxxxxx????xx????xxx????xxxxxxx????xx");
+
+// Last SIG_SCAN first
+static SigDefinition* const sigRegistry = SigChain<__COUNTER__>::head;
+
+static uint32 sigRegistryCount()
+{
+    uint32 count = 0;
+    for (SigDefinition* def = sigRegistry; def; def = def->next)
+        ++count;
+    return count;
+}
+
+// Resolved addresses are kept between launches, keyed by the identity of the game executable.
+// A cached address is only trusted after its pattern matches there again.
+const uint32 SIGCACHE_SIGNATURE = 0x43534F42; // "BOSC"
+const uint32 SIGCACHE_VERSION   = 2;
+// Pages of each code section that go into the cache key
+const size_t SIGCACHE_HASH_PAGES = 64;
+const size_t SIGCACHE_PAGE_SIZE  = 0x1000;
+
+struct SigCacheHeader
+{
+    uint32 signature;
+    uint32 version;
+    uint32 timeDateStamp;
+    uint32 sizeOfImage;
+    uint64 codeHash;
+    uint32 entryCount;
+    uint32 reserved;
+};
+
+struct SigCacheEntry
+{
+    uint64 nameHash;
+    uint32 rva;
+    uint32 alternative;
+};
+
+static bool sigGetCacheKey(SigCacheHeader& key)
+{
+    const IMAGE_NT_HEADERS* ntHeaders = getNtHeaders();
+    if (!ntHeaders)
+        return false;
+
+    memset(&key, 0, sizeof(key));
+    key.signature     = SIGCACHE_SIGNATURE;
+    key.version       = SIGCACHE_VERSION;
+    key.timeDateStamp = ntHeaders->FileHeader.TimeDateStamp;
+    key.sizeOfImage   = getModuleInfo().SizeOfImage;
+    // Hashing all of the code every launch costs about as much as a scan, which is what the cache is there to avoid.
+    // Pages spread through each section catch a patched or different build, and every cached offset
+    // is still checked against its pattern before it's used
+    for (const SigRegion& region : getCodeRegions())
+    {
+        if (region.size <= SIGCACHE_HASH_PAGES * SIGCACHE_PAGE_SIZE)
+        {
+            key.codeHash = OriginsBASS::Hash64(region.begin, region.size, key.codeHash);
+            continue;
+        }
+        const size_t stride = (region.size - SIGCACHE_PAGE_SIZE) / (SIGCACHE_HASH_PAGES - 1);
+        for (size_t page = 0; page < SIGCACHE_HASH_PAGES; ++page)
+            key.codeHash = OriginsBASS::Hash64(region.begin + page * stride, SIGCACHE_PAGE_SIZE, key.codeHash);
+    }
+    return true;
+}
+
+static bool sigVerify(SigDefinition* def, int alternative, const uint8* address)
+{
+    const char* signature = def->data[alternative * 2];
+    const char* mask      = def->data[alternative * 2 + 1];
+    const size_t length   = strlen(mask);
+
+    for (const SigRegion& region : getCodeRegions())
+    {
+        if (address >= region.begin && length <= region.size && address <= region.begin + region.size - length)
+            return compareMasked(address, signature, mask, length);
+    }
+    return false;
+}
+
+static uint32 sigLoadCache(const char* path, const SigCacheHeader& key)
+{
+    FILE* file;
+    fopen_s(&file, path, "rb");
+    if (!file)
+        return 0;
+
+    fseek(file, 0, SEEK_END);
+    const long fileSize = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    // The entry count comes from the file, so it can't ask for more entries than the file holds
+    SigCacheHeader header;
+    std::vector<SigCacheEntry> entries;
+    bool valid = fileSize >= (long)sizeof(header) && fread(&header, sizeof(header), 1, file) == 1 && header.signature == key.signature
+                 && header.version == key.version && header.timeDateStamp == key.timeDateStamp && header.sizeOfImage == key.sizeOfImage
+                 && header.codeHash == key.codeHash && header.entryCount <= (fileSize - sizeof(header)) / sizeof(SigCacheEntry);
+    if (valid)
+    {
+        entries.resize(header.entryCount);
+        valid = fread(entries.data(), sizeof(SigCacheEntry), entries.size(), file) == entries.size();
+    }
+    fclose(file);
+    if (!valid)
+        return 0;
+
+    const uint8* base     = (const uint8*)getModuleInfo().lpBaseOfDll;
+    uint32 resolvedCount  = 0;
+    for (SigDefinition* def = sigRegistry; def; def = def->next)
+    {
+        const uint64 nameHash = OriginsBASS::HashString(def->name);
+        for (SigCacheEntry& entry : entries)
+        {
+            if (entry.nameHash != nameHash || (int)entry.alternative * 2 + 1 >= def->count)
+                continue;
+            if (sigVerify(def, entry.alternative, base + entry.rva))
+            {
+                *def->address    = (void*)(base + entry.rva);
+                def->alternative = entry.alternative;
+                ++resolvedCount;
+            }
+            break;
+        }
+    }
+    return resolvedCount;
+}
+
+static void sigSaveCache(const char* path, const SigCacheHeader& key)
+{
+    const uint8* base = (const uint8*)getModuleInfo().lpBaseOfDll;
+
+    std::vector<SigCacheEntry> entries;
+    for (SigDefinition* def = sigRegistry; def; def = def->next)
+    {
+        if (*def->address)
+            entries.push_back({ OriginsBASS::HashString(def->name), (uint32)((const uint8*)*def->address - base), (uint32)def->alternative });
+    }
+
+    SigCacheHeader header = key;
+    header.entryCount     = (uint32)entries.size();
+
+    // Write to a temporary file first so a crash never leaves a half written cache
+    char tempPath[MAX_PATH];
+    sprintf_s(tempPath, "%s.tmp", path);
+    FILE* file;
+    fopen_s(&file, tempPath, "wb");
+    if (!file)
+        return;
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(entries.data(), sizeof(SigCacheEntry), entries.size(), file) == entries.size();
+    fclose(file);
+    if (!written || !MoveFileExA(tempPath, path, MOVEFILE_REPLACE_EXISTING))
+        DeleteFileA(tempPath);
+}
+
+void SigResolveAll()
+{
+    static bool resolved = false;
+    if (resolved)
+        return;
+    resolved = true;
+
+    char cachePath[MAX_PATH];
+    SigCacheHeader cacheKey;
+    const bool useCache = OriginsBASS::Config::GetCachePath(cachePath, sizeof(cachePath), "sigcache.bin") && sigGetCacheKey(cacheKey);
+    const uint32 cachedCount = useCache ? sigLoadCache(cachePath, cacheKey) : 0;
+    if (cachedCount == sigRegistryCount())
+    {
+        printf("[OriginsBASS] All %u signatures resolved from cache\n", cachedCount);
+        return;
+    }
+
+    // Only scan for what the cache didn't cover
+    std::vector<SigPattern> patterns;
+    for (SigDefinition* def = sigRegistry; def; def = def->next)
+    {
+        if (*def->address)
+            continue;
+
+        for (int i = 0; i + 1 < def->count; i += 2)
+        {
+            SigPattern pattern{};
+            pattern.owner       = def;
+            pattern.alternative = i / 2;
+            pattern.signature = def->data[i];
+            pattern.mask      = def->data[i + 1];
+            pattern.length    = strlen(pattern.mask);
+            findAnchor(pattern.mask, pattern.length, pattern.anchorOffset, pattern.anchorLength);
+            if (!pattern.anchorLength)
+                printf("[OriginsBASS] Signature %s has no fixed bytes, skipping\n", def->name);
+            else
+                pattern.key = sigKey((const uint8*)pattern.signature + pattern.anchorOffset, pattern.anchorLength);
+            patterns.push_back(pattern);
+        }
+    }
+
+    // Split the code into one chunk per thread. Chunks overlap by the longest pattern so
+    // matches crossing a boundary are still found, but every start position is owned by one chunk.
+    size_t maxLength = 1;
+    for (SigPattern& pattern : patterns)
+        maxLength = (std::max)(maxLength, pattern.length);
+
+    uint32 threadCount = OriginsBASS::Config::sigScanThreads ? OriginsBASS::Config::sigScanThreads : (std::max)(std::thread::hardware_concurrency(), 1u);
+
+    size_t totalSize = 0;
+    for (const SigRegion& region : getCodeRegions())
+        totalSize += region.size;
+    const size_t chunkSize = (std::max)(totalSize / threadCount + 1, (size_t)0x10000);
+
+    struct SigChunk
+    {
+        const uint8* begin;
+        size_t size;
+        size_t ownedSize;
+        std::vector<SigPattern> patterns;
+    };
+    std::vector<SigChunk> chunks;
+    for (const SigRegion& region : getCodeRegions())
+    {
+        for (size_t offset = 0; offset < region.size; offset += chunkSize)
+        {
+            const size_t ownedSize = (std::min)(chunkSize, region.size - offset);
+            chunks.push_back({ region.begin + offset, (std::min)(ownedSize + maxLength - 1, region.size - offset), ownedSize, patterns });
+        }
+    }
+
+    // Every region is split on its own, so there can be a few more chunks than threads. The calling thread
+    // counts as one of the threads and they all take chunks from the same counter until none are left
+    std::atomic<size_t> nextChunk{ 0 };
+    auto scanChunks = [&chunks, &nextChunk]
+    {
+        for (size_t c = nextChunk++; c < chunks.size(); c = nextChunk++)
+            sigScanPatterns(chunks[c].begin, chunks[c].size, chunks[c].ownedSize, chunks[c].patterns);
+    };
+
+    std::vector<std::thread> workers;
+    const size_t workerCount = (std::min)((size_t)threadCount, chunks.size());
+    for (size_t t = 1; t < workerCount; ++t)
+        workers.emplace_back(scanChunks);
+    scanChunks();
+    for (std::thread& worker : workers)
+        worker.join();
+
+    // Chunks are in address order, so the first chunk with a match has the lowest one
+    for (SigChunk& chunk : chunks)
+    {
+        for (size_t p = 0; p < patterns.size(); ++p)
+        {
+            if (!chunk.patterns[p].matchCount)
+                continue;
+            if (!patterns[p].matchCount)
+                patterns[p].firstMatch = chunk.patterns[p].firstMatch;
+            patterns[p].matchCount += chunk.patterns[p].matchCount;
+        }
+    }
+
+    // Alternatives are tried in the order they're listed
+    for (SigDefinition* def = sigRegistry; def; def = def->next)
+    {
+        if (*def->address)
+            continue;
+
+        for (SigPattern& pattern : patterns)
+        {
+            if (pattern.owner != def || !pattern.matchCount)
+                continue;
+            if (pattern.matchCount > 1)
+                printf("[OriginsBASS] Signature %s is ambiguous, %u matches\n", def->name, pattern.matchCount);
+            *def->address    = (void*)pattern.firstMatch;
+            def->alternative = pattern.alternative;
+            break;
+        }
+
+        if (!*def->address)
+        {
+            printf("[OriginsBASS] Signature %s not found\n", def->name);
+            SigValid = false;
+        }
+    }
+
+    if (useCache)
+        sigSaveCache(cachePath, cacheKey);
+}
@@ -2,4 +2,6 @@
 
 extern bool SigValid;
 
+extern void SigResolveAll();
+
 extern void* SigLinkGameLogicDLL();
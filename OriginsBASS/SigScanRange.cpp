@@ -0,0 +1,50 @@
+#include "SigScanRange.h"
+#include <cstring>
+#include <emmintrin.h>
+
+void* sigScanRange(const uint8_t* begin, size_t size, const char* signature, const char* mask)
+{
+    const size_t length = strlen(mask);
+    if (length > size)
+        return nullptr;
+
+    size_t anchorOffset, anchorLength;
+    findAnchor(mask, length, anchorOffset, anchorLength);
+    if (!anchorLength)
+        return (void*)begin;
+
+    // Candidates are filtered on the first and last byte of the anchor, 16 positions at a time.
+    // Only positions that match both get the full masked compare.
+    const uint8_t anchorFirst = (uint8_t)signature[anchorOffset];
+    const uint8_t anchorLast  = (uint8_t)signature[anchorOffset + anchorLength - 1];
+    const __m128i first       = _mm_set1_epi8((char)anchorFirst);
+    const __m128i last        = _mm_set1_epi8((char)anchorLast);
+
+    const size_t lastStart = size - length;
+    size_t start           = 0;
+    for (; start + anchorOffset + anchorLength - 1 + 16 <= size && start <= lastStart; start += 16)
+    {
+        const uint8_t* anchor = begin + start + anchorOffset;
+        const __m128i a       = _mm_loadu_si128(reinterpret_cast<const __m128i*>(anchor));
+        const __m128i b       = _mm_loadu_si128(reinterpret_cast<const __m128i*>(anchor + anchorLength - 1));
+        uint32_t hits         = (uint32_t)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+
+        for (; hits; hits &= hits - 1)
+        {
+            const size_t candidate = start + lowestBit(hits);
+            if (candidate > lastStart)
+                break;
+            if (compareMasked(begin + candidate, signature, mask, length))
+                return (void*)(begin + candidate);
+        }
+    }
+
+    // Tail
+    for (; start <= lastStart; start++)
+    {
+        if (begin[start + anchorOffset] == anchorFirst && compareMasked(begin + start, signature, mask, length))
+            return (void*)(begin + start);
+    }
+
+    return nullptr;
+}
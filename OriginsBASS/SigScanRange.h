@@ -0,0 +1,53 @@
+#pragma once
+
+// Single pattern scanning over a block of memory.
+// Doesn't depend on Windows or the mod's headers, so it can be built and benchmarked on its own.
+
+#include <cstddef>
+#include <cstdint>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Finds the longest run of fixed bytes in a mask
+inline void findAnchor(const char* mask, size_t length, size_t& anchorOffset, size_t& anchorLength)
+{
+    anchorOffset = 0;
+    anchorLength = 0;
+
+    size_t runStart = 0;
+    for (size_t i = 0; i <= length; i++)
+    {
+        if (i == length || mask[i] == '?')
+        {
+            if (i - runStart > anchorLength)
+            {
+                anchorOffset = runStart;
+                anchorLength = i - runStart;
+            }
+            runStart = i + 1;
+        }
+    }
+}
+
+inline bool compareMasked(const uint8_t* memory, const char* signature, const char* mask, size_t length)
+{
+    for (size_t j = 0; j < length; j++)
+        if (mask[j] != '?' && (uint8_t)signature[j] != memory[j])
+            return false;
+    return true;
+}
+
+inline uint32_t lowestBit(uint32_t mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+// First match of signature in [begin, begin + size). '?' in the mask is a wildcard
+void* sigScanRange(const uint8_t* begin, size_t size, const char* signature, const char* mask);
@@ -0,0 +1,238 @@
+#include "pch.h"
+#include "Config.hpp"
+#include "TempoQuality.hpp"
+#include "DecodeAhead.hpp"
+#include <chrono>
+
+namespace OriginsBASS {
+    namespace TempoQuality {
+
+        struct TierOptions {
+            const char* name;
+            bool useAAFilter;
+            uint32 aaFilterLength;
+            bool useQuickAlgo;
+            uint32 sequenceMs;
+            uint32 seekWindowMs;
+            uint32 overlapMs;
+        };
+
+        // Normal is BASS_FX's own default
+        static const TierOptions tiers[TEMPO_QUALITY_COUNT] = {
+            { "High", true, 64, false, 82, 28, 8 },
+            { "Normal", true, 32, false, 82, 28, 8 },
+            { "Low", true, 16, true, 82, 20, 8 },
+            { "Minimum", false, 8, true, 100, 15, 6 },
+        };
+
+        const ULONGLONG UPDATE_INTERVAL_MS = 250;
+        // Percent of the mixer's update period, from BASS_GetCPU and BASS_ATTRIB_CPU
+        const float MIXER_LOAD_HIGH = 40.0f;
+        const float MIXER_LOAD_LOW  = 15.0f;
+        const float TEMPO_LOAD_HIGH = 20.0f;
+        const float TEMPO_LOAD_LOW  = 8.0f;
+        // Consecutive samples needed before changing tier
+        const uint32 DEGRADE_SAMPLES = 2;
+        const uint32 RESTORE_SAMPLES = 16;
+        // Samples taken at each tier in benchmark mode
+        const uint32 BENCHMARK_SAMPLES = 40;
+        // Audio decoded for each pass of the speed 1.0 comparison
+        const double UNITY_SECONDS = 20.0;
+
+        static int32 currentTier      = TEMPO_QUALITY_HIGH;
+        static bool tierPicked        = false;
+        static bool benchmarkDone     = false;
+        static ULONGLONG lastUpdate   = 0;
+        static uint32 overloadStreak  = 0;
+        static uint32 idleStreak      = 0;
+        static double tierLoad[TEMPO_QUALITY_COUNT]{};
+        static uint32 tierSamples[TEMPO_QUALITY_COUNT]{};
+
+        // What a voice at speed 1.0 costs with and without the tempo processor, in percent of one core.
+        // Voices only get the processor once their speed changes, so the difference is saved on every other voice.
+        // Written by the measuring thread before it sets unityDone, and only read after that
+        static bool unityStarted  = false;
+        static bool unityReported = false;
+        static std::atomic<bool> unityDone{ false };
+        static double unityPlainLoad = 0.0;
+        static double unityTempoLoad[TEMPO_QUALITY_COUNT]{};
+
+        int32 ParseTier(const char* name) {
+            for (int32 i = 0; i < TEMPO_QUALITY_COUNT; ++i) {
+                if (!_stricmp(name, tiers[i].name))
+                    return i;
+            }
+            return !_stricmp(name, "Benchmark") ? TEMPO_QUALITY_BENCHMARK : TEMPO_QUALITY_AUTO;
+        }
+
+        static int32 GetTier() {
+            if (!tierPicked) {
+                if (Config::tempoQuality >= 0)
+                    currentTier = Config::tempoQuality;
+                tierPicked = true;
+            }
+            return currentTier;
+        }
+
+        void Apply(HSTREAM stream) { ApplyTier(stream, GetTier()); }
+
+        void ApplyTier(HSTREAM stream, int32 tier) {
+            const TierOptions& options = tiers[tier];
+            BASS_ChannelSetAttribute(stream, BASS_ATTRIB_TEMPO_OPTION_USE_AA_FILTER, options.useAAFilter ? 1.0f : 0.0f);
+            BASS_ChannelSetAttribute(stream, BASS_ATTRIB_TEMPO_OPTION_AA_FILTER_LENGTH, (float)options.aaFilterLength);
+            BASS_ChannelSetAttribute(stream, BASS_ATTRIB_TEMPO_OPTION_USE_QUICKALGO, options.useQuickAlgo ? 1.0f : 0.0f);
+            BASS_ChannelSetAttribute(stream, BASS_ATTRIB_TEMPO_OPTION_SEQUENCE_MS, (float)options.sequenceMs);
+            BASS_ChannelSetAttribute(stream, BASS_ATTRIB_TEMPO_OPTION_SEEKWINDOW_MS, (float)options.seekWindowMs);
+            BASS_ChannelSetAttribute(stream, BASS_ATTRIB_TEMPO_OPTION_OVERLAP_MS, (float)options.overlapMs);
+        }
+
+        static void SetTier(int32 tier, float mixerLoad, float tempoLoad) {
+            printf("[OriginsBASS] Tempo quality %s -> %s (mixer %.1f%%, tempo %.1f%%)\n", tiers[currentTier].name, tiers[tier].name, mixerLoad, tempoLoad);
+            currentTier    = tier;
+            overloadStreak = 0;
+            idleStreak     = 0;
+
+            for (int i = 0; i < CHANNEL_COUNT; ++i) {
+                if (Audio::channels[i].tempoActive && Audio::channels[i].basschan)
+                    Apply(DecodeAhead::Source(Audio::channels[i].basschan));
+            }
+            PrintReport();
+        }
+
+        // Decodes as fast as it can and gives the time it took in percent of the audio's duration, or a negative on failure.
+        // The thread doing it has nothing else to do, so that's close to its CPU time
+        static double DecodeLoad(const char* path, int32 tier) {
+            HSTREAM stream = BASS_StreamCreateFile(false, path, 0, 0, BASS_STREAM_DECODE | BASS_SAMPLE_FLOAT);
+            if (stream && tier >= 0) {
+                HSTREAM tempo = BASS_FX_TempoCreate(stream, BASS_STREAM_DECODE | BASS_FX_FREESOURCE);
+                if (!tempo)
+                    BASS_StreamFree(stream);
+                stream = tempo;
+                if (stream) {
+                    ApplyTier(stream, tier);
+                    BASS_ChannelSetAttribute(stream, BASS_ATTRIB_TEMPO, 0.0f);
+                }
+            }
+            if (!stream)
+                return -1.0;
+
+            QWORD target = BASS_ChannelSeconds2Bytes(stream, UNITY_SECONDS);
+            QWORD done   = 0;
+            std::vector<uint8> buffer(0x10000);
+            auto start = std::chrono::high_resolution_clock::now();
+            while (done < target) {
+                DWORD length = BASS_ChannelGetData(stream, buffer.data(), (DWORD)buffer.size() | BASS_DATA_FLOAT);
+                if (length == (DWORD)-1)
+                    break;
+                done += length;
+            }
+            double elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+            double seconds = BASS_ChannelBytes2Seconds(stream, done);
+            BASS_StreamFree(stream);
+            return seconds > 0.0 ? elapsed * 100.0 / seconds : -1.0;
+        }
+
+        // Runs on a thread of its own so the mixer and the audio thread aren't held up.
+        // Update prints the result, so the report is only ever built on the thread that owns the tier state
+        static void MeasureUnity(std::string path) {
+            unityPlainLoad = DecodeLoad(path.c_str(), -1);
+            for (int32 i = 0; i < TEMPO_QUALITY_COUNT; ++i)
+                unityTempoLoad[i] = DecodeLoad(path.c_str(), i);
+            unityDone.store(true, std::memory_order_release);
+        }
+
+        void Update() {
+            ULONGLONG now = GetTickCount64();
+            if (now - lastUpdate < UPDATE_INTERVAL_MS)
+                return;
+            lastUpdate = now;
+
+            const int32 tier = GetTier();
+
+            if (!unityReported && unityDone.load(std::memory_order_acquire)) {
+                unityReported = true;
+                PrintReport();
+            }
+
+            // Benchmark mode also compares a music track at speed 1.0 with and without the tempo processor
+            if (Config::tempoQuality == TEMPO_QUALITY_BENCHMARK && !unityStarted) {
+                for (int i = 0; i < CHANNEL_COUNT; ++i) {
+                    const Audio::AudioChannel& channel = Audio::channels[i];
+                    if (channel.basschan && !channel.sourceBuffer && channel.sourcePath[0]) {
+                        unityStarted = true;
+                        std::thread(MeasureUnity, std::string(channel.sourcePath)).detach();
+                        break;
+                    }
+                }
+            }
+
+            float tempoLoad    = 0.0f;
+            uint32 tempoVoices = 0;
+            for (int i = 0; i < CHANNEL_COUNT; ++i) {
+                float load;
+                if (Audio::channels[i].tempoActive && BASS_ChannelGetAttribute(DecodeAhead::Source(Audio::channels[i].basschan), BASS_ATTRIB_CPU, &load)) {
+                    tempoLoad += load;
+                    ++tempoVoices;
+                }
+            }
+
+            // Nothing to gain from changing tier without any tempo voices
+            if (!tempoVoices) {
+                overloadStreak = 0;
+                idleStreak     = 0;
+                return;
+            }
+
+            tierLoad[tier] += tempoLoad / tempoVoices;
+            tierSamples[tier]++;
+
+            float mixerLoad = BASS_GetCPU();
+            if (Config::tempoQuality == TEMPO_QUALITY_BENCHMARK) {
+                if (benchmarkDone || tierSamples[tier] < BENCHMARK_SAMPLES)
+                    return;
+                if (tier + 1 < TEMPO_QUALITY_COUNT) {
+                    SetTier(tier + 1, mixerLoad, tempoLoad);
+                }
+                else {
+                    benchmarkDone = true;
+                    printf("[OriginsBASS] Tempo quality benchmark finished\n");
+                    PrintReport();
+                }
+                return;
+            }
+
+            if (Config::tempoQuality != TEMPO_QUALITY_AUTO)
+                return;
+
+            bool overloaded = mixerLoad > MIXER_LOAD_HIGH || tempoLoad > TEMPO_LOAD_HIGH;
+            bool idle       = mixerLoad < MIXER_LOAD_LOW && tempoLoad < TEMPO_LOAD_LOW;
+            overloadStreak  = overloaded ? overloadStreak + 1 : 0;
+            idleStreak      = idle ? idleStreak + 1 : 0;
+
+            if (overloadStreak >= DEGRADE_SAMPLES && tier + 1 < TEMPO_QUALITY_COUNT)
+                SetTier(tier + 1, mixerLoad, tempoLoad);
+            else if (idleStreak >= RESTORE_SAMPLES && tier > TEMPO_QUALITY_HIGH)
+                SetTier(tier - 1, mixerLoad, tempoLoad);
+        }
+
+        void PrintReport() {
+            printf("[OriginsBASS] Tempo quality   CPU per voice\n");
+            for (int32 i = 0; i < TEMPO_QUALITY_COUNT; ++i) {
+                if (tierSamples[i])
+                    printf("[OriginsBASS]   %-8s      %6.2f%% (%u samples)\n", tiers[i].name, tierLoad[i] / tierSamples[i], tierSamples[i]);
+                else
+                    printf("[OriginsBASS]   %-8s      not measured\n", tiers[i].name);
+            }
+
+            if (!unityDone.load(std::memory_order_acquire) || unityPlainLoad < 0.0)
+                return;
+            printf("[OriginsBASS] Speed 1.0 without tempo: %.2f%% of a core per voice\n", unityPlainLoad);
+            for (int32 i = 0; i < TEMPO_QUALITY_COUNT; ++i) {
+                if (unityTempoLoad[i] >= 0.0)
+                    printf("[OriginsBASS]   %-8s      %6.2f%% with tempo, %.2f%% saved per voice\n", tiers[i].name, unityTempoLoad[i],
+                           unityTempoLoad[i] - unityPlainLoad);
+            }
+        }
+
+    } // namespace TempoQuality
+} // namespace OriginsBASS
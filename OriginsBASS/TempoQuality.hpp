@@ -0,0 +1,35 @@
+#pragma once
+
+namespace OriginsBASS {
+
+    // Picks the BASS_FX tempo options for voices that go through the tempo processor.
+    // In automatic mode the tier follows the mixer CPU load and what the tempo voices cost,
+    // dropping quality quickly when the mixer is struggling and restoring it slowly once it isn't.
+    // Benchmark mode steps through every tier while tempo voices play and prints the CPU each one cost,
+    // and measures what leaving the tempo processor off a voice at speed 1.0 saves.
+    namespace TempoQuality {
+
+        enum QualityTiers {
+            TEMPO_QUALITY_BENCHMARK = -2,
+            TEMPO_QUALITY_AUTO      = -1,
+            TEMPO_QUALITY_HIGH,
+            TEMPO_QUALITY_NORMAL,
+            TEMPO_QUALITY_LOW,
+            TEMPO_QUALITY_MINIMUM,
+            TEMPO_QUALITY_COUNT,
+        };
+
+        // Returns TEMPO_QUALITY_AUTO for anything that isn't a tier name or "Benchmark"
+        int32 ParseTier(const char* name);
+
+        // Sets the current tier's options on a tempo stream
+        void Apply(HSTREAM stream);
+        void ApplyTier(HSTREAM stream, int32 tier);
+        // Samples the load and changes tier if needed. Call from the thread that owns the channels
+        void Update();
+        // Prints the average tempo cost per voice measured at each tier so far, and the speed 1.0 saving once it's measured.
+        // Reads the state Update keeps, so call it from the same thread
+        void PrintReport();
+
+    } // namespace TempoQuality
+} // namespace OriginsBASS
@@ -0,0 +1,43 @@
+#pragma once
+
+namespace OriginsBASS {
+
+    // Canonical 44 byte header of a PCM or float WAV file
+    struct WaveHeader {
+        uint32 riff;
+        uint32 riffSize;
+        uint32 wave;
+        uint32 fmt;
+        uint32 fmtSize;
+        uint16 formatTag;
+        uint16 channels;
+        uint32 sampleRate;
+        uint32 byteRate;
+        uint16 blockAlign;
+        uint16 bitsPerSample;
+        uint32 data;
+        uint32 dataSize;
+    };
+
+    const uint16 WAVE_FORMAT_PCM_TAG   = 1;
+    const uint16 WAVE_FORMAT_FLOAT_TAG = 3;
+
+    inline WaveHeader MakeWaveHeader(uint16 formatTag, uint16 channels, uint32 sampleRate, uint16 bitsPerSample, uint32 dataSize) {
+        WaveHeader header{};
+        header.riff          = 0x46464952; // "RIFF"
+        header.riffSize      = sizeof(WaveHeader) - 8 + dataSize;
+        header.wave          = 0x45564157; // "WAVE"
+        header.fmt           = 0x20746D66; // "fmt "
+        header.fmtSize       = 16;
+        header.formatTag     = formatTag;
+        header.channels      = channels;
+        header.sampleRate    = sampleRate;
+        header.blockAlign    = (uint16)(channels * bitsPerSample / 8);
+        header.byteRate      = sampleRate * header.blockAlign;
+        header.bitsPerSample = bitsPerSample;
+        header.data          = 0x61746164; // "data"
+        header.dataSize      = dataSize;
+        return header;
+    }
+
+} // namespace OriginsBASS
@@ -0,0 +1,61 @@
+#include "pch.h"
+#include "WorkerPool.hpp"
+
+namespace OriginsBASS {
+
+    void WorkerPool::Start(uint32 count) {
+        if (threadCount)
+            return;
+
+        if (!count) {
+            // Leave one core for the game thread
+            uint32 cores = std::thread::hardware_concurrency();
+            count = cores > 1 ? cores - 1 : 1;
+        }
+
+        threadCount = count;
+        for (uint32 i = 0; i < count; ++i)
+            std::thread(&WorkerPool::WorkerMain, this).detach();
+    }
+
+    void WorkerPool::Enqueue(std::function<void()> job) {
+        // Not started, run inline
+        if (!threadCount) {
+            job();
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            jobs.push_back(std::move(job));
+        }
+        jobReady.notify_one();
+    }
+
+    void WorkerPool::WaitIdle() {
+        std::unique_lock<std::mutex> guard(lock);
+        jobsDone.wait(guard, [this] { return jobs.empty() && !busyCount; });
+    }
+
+    void WorkerPool::WorkerMain() {
+        for (;;) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                jobReady.wait(guard, [this] { return !jobs.empty(); });
+                job = std::move(jobs.front());
+                jobs.pop_front();
+                ++busyCount;
+            }
+
+            job();
+
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                --busyCount;
+            }
+            jobsDone.notify_all();
+        }
+    }
+
+} // namespace OriginsBASS
@@ -0,0 +1,26 @@
+#pragma once
+
+namespace OriginsBASS {
+
+    // Small fixed-size thread pool for background file work.
+    // Threads are detached, the pool lives until the process exits.
+    class WorkerPool {
+    public:
+        void Start(uint32 threadCount);
+        void Enqueue(std::function<void()> job);
+        void WaitIdle();
+
+        uint32 ThreadCount() const { return threadCount; }
+
+    private:
+        void WorkerMain();
+
+        std::deque<std::function<void()>> jobs;
+        std::mutex lock;
+        std::condition_variable jobReady;
+        std::condition_variable jobsDone;
+        uint32 busyCount = 0;
+        uint32 threadCount = 0;
+    };
+
+} // namespace OriginsBASS
@@ -1,8 +1,17 @@
 #include "pch.h"
 #include "HiteModLoader.h"
-#include "IniReader.h"
+#include "IniView.hpp"
 #include "Helpers.h"
 #include "SigScan.h"
+#include "Config.hpp"
+#include "Hash.hpp"
+#include "LoopCache.hpp"
+#include "DecoderPool.hpp"
+#include "MusicCache.hpp"
+#include "PCMCache.hpp"
+#include "DecodeAhead.hpp"
+#include "BufferMonitor.hpp"
+#include "Latency.hpp"
 #include "mod.hpp"
 #include <string>
 #include <unordered_map>
@@ -54,39 +63,59 @@ namespace OriginsBASS {
         void *hedgehogLink;
     };
 
-    struct AudioInfo {
-        int32 loopStart;
-        int32 loopEnd;
-    };
+    void ParseAllLoopReplacements() {
+        // Key the compiled table on every audio.ini and when it was last written
+        uint64 sourceKey = Hash64(&ModPathCount, sizeof(ModPathCount));
+        for (int i = 0; i < ModPathCount; i++) {
+            char iniPath[MAX_PATH];
+            sprintf_s(iniPath, "%s\\audio.ini", ModPaths[i]);
+            WIN32_FILE_ATTRIBUTE_DATA attributes;
+            if (GetFileAttributesExA(iniPath, GetFileExInfoStandard, &attributes)) {
+                sourceKey = HashString(iniPath, sourceKey);
+                sourceKey = Hash64(&attributes.ftLastWriteTime, sizeof(attributes.ftLastWriteTime), sourceKey);
+                sourceKey = Hash64(&attributes.nFileSizeLow, sizeof(attributes.nFileSizeLow), sourceKey);
+            }
+        }
 
-    std::unordered_map<std::string, AudioInfo> loopReplacements;
+        char cachePath[MAX_PATH];
+        bool hasCachePath = Config::GetCachePath(cachePath, sizeof(cachePath), "audio.loopcache");
+        if (hasCachePath && LoopCache::Open(cachePath, sourceKey)) {
+            printf("[OriginsBASS] Loaded %u loop entries from cache\n", LoopCache::EntryCount());
+            return;
+        }
 
-    void ParseAllLoopReplacements() {
+        std::unordered_map<std::string, AudioInfo> loopReplacements;
         for (int i = 0; i < ModPathCount; i++) {
             char iniPath[MAX_PATH];
             sprintf_s(iniPath, "%s\\audio.ini", ModPaths[i]);
             if (GetFileAttributesA(iniPath) != INVALID_FILE_ATTRIBUTES) {
-                INIReader ini(iniPath);
+                IniView ini(iniPath);
                 printf("[OriginsBASS] Loading loop info from %s\n", iniPath);
-                if (ini.ParseError() == -1) {
+                if (!ini.isOpen()) {
+                    // Stop here like the loader always has, but keep what was read so far out of the cache
+                    // so the broken file is read again next launch
                     printf("[OriginsBASS] INI parse error: \"%s\"\n", iniPath);
+                    LoopCache::Build(nullptr, sourceKey, loopReplacements);
                     return;
                 }
-                for (auto& section : ini.Sections()) {
+                for (std::string_view view : ini.groups()) {
+                    std::string section(view);
                     auto it = loopReplacements.find(section);
                     if (it != loopReplacements.end()) {
-                        it->second.loopStart = ini.GetInteger(section, "loopStart", it->second.loopStart);
-                        it->second.loopEnd = ini.GetInteger(section, "loopEnd", it->second.loopEnd);
+                        it->second.loopStart = ini.getInt(view, "loopStart", it->second.loopStart);
+                        it->second.loopEnd = ini.getInt(view, "loopEnd", it->second.loopEnd);
                     } else {
                         AudioInfo info;
-                        info.loopStart = ini.GetInteger(section, "loopStart", -1);
-                        info.loopEnd = ini.GetInteger(section, "loopEnd", -1);
+                        info.loopStart = ini.getInt(view, "loopStart", -1);
+                        info.loopEnd = ini.getInt(view, "loopEnd", -1);
                         loopReplacements[section] = info;
                         printf("[OriginsBASS] Added loop info to %s\n", section.c_str());
                     }
                 }
             }
         }
+
+        LoopCache::Build(hasCachePath ? cachePath : nullptr, sourceKey, loopReplacements);
     }
 
     bool32 FindModFile(char* out, uint32 outLen, char* path) {
@@ -107,20 +136,30 @@ namespace OriginsBASS {
     }
 
     HOOK(int32, __fastcall, PlaySfx, 0x1400DDEA0, uint16 sfx, int32 loopPoint, int32 priority) {
-        Audio::PlaySfx(sfx, loopPoint, priority);
+        Audio::QueuePlaySfx(sfx, loopPoint, priority);
         return sfx;
     }
 
-    HOOK(int32, __fastcall, PlayStream, 0x1400DDEB0, const char* filename, uint32 channel, uint32 startPos, uint32 loopPoint, bool32 loadASync) {
-        printf("[OriginsBASS] PlayStream(\"%s\", %u, %u, %u, %u)\n", filename, channel, startPos, loopPoint, loadASync);
-
-        // Legacy passes -1
-        if (channel == -1)
-            channel = 0;
+    // Fast music lives in an "F" folder next to the normal track.
+    // S3K tracks are left out, PlayStream already plays those faster with the tempo processor
+    static bool GetCounterpartName(char* out, uint32 outLen, const char* filename) {
+        std::string name = filename;
+        if (name.find("3K/") != std::string::npos)
+            return false;
 
-        if (channel >= CHANNEL_COUNT)
-            return -1;
+        size_t fastPos = name.find("F/");
+        if (fastPos != std::string::npos && (fastPos == 0 || name[fastPos - 1] == '/')) {
+            name.erase(fastPos, 2);
+        }
+        else {
+            size_t slash = name.rfind('/');
+            name.insert(slash == std::string::npos ? 0 : slash + 1, "F/");
+        }
+        return !strcpy_s(out, outLen, name.c_str());
+    }
 
+    // Runs on the audio thread when it's enabled
+    void StartStream(const char* filename, uint32 channel, uint32 startPos, uint32 loopPoint) {
         Audio::AudioChannel *channelEntry = &Audio::channels[channel];
 
         // I aren't rewriting this
@@ -165,46 +204,104 @@ namespace OriginsBASS {
                 {
                     printf("  Speed change %f -> %f\n", channelEntry->streamSpeed, newSpeed);
                     channelEntry->streamSpeed = newSpeed;
-                    BASS_ChannelSetAttribute(channelEntry->basschan, BASS_ATTRIB_TEMPO, (newSpeed - 1.0f) * 100.0f);
+                    Audio::SetChannelSpeed(channel, newSpeed);
                     strcpy_s(channelEntry->name, filename);
-                    return channelEntry->basschan ? channel : -1;
+                    return;
                 }
             }
         }
+
+        // Normal <-> fast on a paired voice is just a crossfade, the position is carried over
+        if (Audio::SwitchDeck(channel, filename)) {
+            printf("  Switched deck to %s\n", filename);
+            return;
+        }
+
+        // Going back to a track after a jingle, the suspended stream is already at the point the game saved
+        if (startPos && Audio::ResumeSuspended(channel, filename))
+            return;
+
         char filePath[MAX_PATH];
         sprintf_s(filePath, "%s\\Data\\Music\\%s", ModLoaderData->GetDataPackName(), filename);
         
         if (FindModFile(filePath, sizeof(filePath), filePath)) {
-            auto it = loopReplacements.find(filename);
-            if (it != loopReplacements.end())
-                Audio::LoadStream(channel, filePath, filename, loopPoint ? it->second.loopStart : 0, it->second.loopEnd);
-            else 
-                Audio::LoadStream(channel, filePath, filename, loopPoint, -1);
+            DualDeck::DeckTrack main = { filePath, (int32)loopPoint, -1 };
+            AudioInfo loopInfo;
+            if (LoopCache::Find(filename, &loopInfo)) {
+                main.loopStart = loopPoint ? loopInfo.loopStart : 0;
+                main.loopEnd   = loopInfo.loopEnd;
+            }
+
+            char altName[MAX_PATH];
+            char altPath[MAX_PATH];
+            if (Config::dualDeck && GetCounterpartName(altName, sizeof(altName), filename)) {
+                sprintf_s(altPath, "%s\\Data\\Music\\%s", ModLoaderData->GetDataPackName(), altName);
+                if (!FindModFile(altPath, sizeof(altPath), altPath))
+                    altName[0] = '\0';
+            }
+            else {
+                altName[0] = '\0';
+            }
+
+            if (altName[0]) {
+                DualDeck::DeckTrack alt = { altPath, (int32)loopPoint, -1 };
+                if (LoopCache::Find(altName, &loopInfo)) {
+                    alt.loopStart = loopPoint ? loopInfo.loopStart : 0;
+                    alt.loopEnd   = loopInfo.loopEnd;
+                }
+                Audio::LoadDeckStream(channel, filename, altName, main, alt);
+            }
+            else {
+                Audio::LoadStream(channel, main.path, filename, main.loopStart, main.loopEnd);
+            }
             Audio::PlayChannel(channel, startPos);
         }
         else
             printf("[OriginsBASS] Failed to load file stream \"%s\"\n", filename);
-        return channelEntry->basschan ? channel : -1;
+    }
+
+    HOOK(int32, __fastcall, PlayStream, 0x1400DDEB0, const char* filename, uint32 channel, uint32 startPos, uint32 loopPoint, bool32 loadASync) {
+        printf("[OriginsBASS] PlayStream(\"%s\", %u, %u, %u, %u)\n", filename, channel, startPos, loopPoint, loadASync);
+
+        // Legacy passes -1
+        if (channel == -1)
+            channel = 0;
+
+        if (channel >= CHANNEL_COUNT)
+            return -1;
+
+        // The file is looked up here so a missing one still answers -1. Only a channel that's already playing keeps
+        // its number, the request can still become a speed change on that stream, same as before the audio thread
+        char filePath[MAX_PATH];
+        sprintf_s(filePath, "%s\\Data\\Music\\%s", ModLoaderData->GetDataPackName(), filename);
+        if (!FindModFile(filePath, sizeof(filePath), filePath)) {
+            int32 result = Audio::GetChannelState(channel) != Audio::CHANNEL_IDLE ? channel : -1;
+            Audio::QueuePlayStream(filename, channel, startPos, loopPoint, false);
+            return result;
+        }
+
+        Audio::QueuePlayStream(filename, channel, startPos, loopPoint, true);
+        return Audio::GetChannelState(channel) != Audio::CHANNEL_IDLE ? channel : -1;
     }
 
     HOOK(void, __fastcall, SetChannelAttributes, 0x1400DDDB0, uint8 channel, float volume, float panning, float speed) {
-        Audio::SetChannelAttributes(channel, volume, panning, speed);
+        Audio::QueueSetChannelAttributes(channel, volume, panning, speed);
     }
     HOOK(void, __fastcall, StopChannel, 0x1400DDF50, uint32 channel) {
-        Audio::StopChannel(channel);
+        Audio::QueueStopChannel(channel);
     }
     HOOK(void, __fastcall, PauseChannel, 0x1400DDE90, uint32 channel) {
-        Audio::PauseChannel(channel);
+        Audio::QueuePauseChannel(channel);
     }
     HOOK(void, __fastcall, ResumeChannel, 0x1400DDEE0, uint32 channel) {
-        Audio::ResumeChannel(channel);
+        Audio::QueueResumeChannel(channel);
     }
 
     bool32 ChannelActive(uint32 channel) {
         if (channel >= CHANNEL_COUNT)
             return false;
         else
-            return (Audio::channels[channel].state & 0x3F) != Audio::CHANNEL_IDLE;
+            return (Audio::GetChannelState(channel) & 0x3F) != Audio::CHANNEL_IDLE;
     }
     uint32 GetChannelPos(uint32 channel) {
         return Audio::GetChannelPos(channel);
@@ -231,7 +328,8 @@ namespace OriginsBASS {
     }
 
 
-    HOOK(void, __fastcall, LinkGameLogicDLL, SigLinkGameLogicDLL(), EngineInfo *info) {
+    // Address is filled in by Init once signatures are resolved
+    HOOK(void, __fastcall, LinkGameLogicDLL, nullptr, EngineInfo *info) {
         RSDKTable = info->RSDKTable;
 
         // Replace functions
@@ -245,7 +343,7 @@ namespace OriginsBASS {
         RSDKTable->ChannelActive = ChannelActive;
         RSDKTable->GetChannelPos = GetChannelPos;
 
-        Audio::ResetChannels();
+        Audio::QueueResetChannels();
         lastSeen = std::chrono::high_resolution_clock::now();
         gamePaused = false;
 
@@ -263,9 +361,9 @@ namespace OriginsBASS {
         if (!gamePaused && lastSeenCount > 40) {
             gamePaused = true;
             for (int i = 0; i < CHANNEL_COUNT; ++i) {
-                pausedChannels[i] = (Audio::channels[i].state & Audio::CHANNEL_PAUSED) == 0;
+                pausedChannels[i] = (Audio::GetChannelState(i) & Audio::CHANNEL_PAUSED) == 0;
                 if (pausedChannels[i])
-                    Audio::PauseChannel(i);
+                    Audio::QueuePauseChannel(i);
             }
         }
     }
@@ -274,10 +372,11 @@ namespace OriginsBASS {
         if (gamePaused) {
             for (int i = 0; i < CHANNEL_COUNT; ++i)
                 if (pausedChannels[i])
-                    Audio::ResumeChannel(i);
+                    Audio::QueueResumeChannel(i);
         }
         gamePaused = false;
         lastSeen = std::chrono::high_resolution_clock::now();
+        Audio::QueueUpdate();
         //printf("LS: %u, LE: %u, S: %u, B: %u\n", channel.loopStart, channel.loopEnd, Audio::GetChannelPos(0), BASS_ChannelGetPosition(channel.basschan, BASS_POS_BYTE));
     }
 
@@ -301,8 +400,9 @@ namespace OriginsBASS {
     extern "C" __declspec(dllexport) void Init(ModInfo *modInfo)
     {
         ModLoaderData = modInfo->ModLoader;
+        Config::Load();
 
-        SigLinkGameLogicDLL();
+        SigResolveAll();
 
         // Check signatures
         if (!SigValid)
@@ -310,14 +410,27 @@ namespace OriginsBASS {
             MessageBoxW(nullptr, L"Signature Scan Failed!\n\nThis usually means there is a conflict or the mod is running on an incompatible game version.", L"Scan Error", MB_ICONERROR);
             return;
         }
+        *reinterpret_cast<void**>(&originalLinkGameLogicDLL) = SigLinkGameLogicDLL();
 
-        if (!BASS_Init(-1, 44100, 0, nullptr, nullptr))
+        Latency::ApplyProfile();
+        // Device 0 is BASS's no sound device, voices still play and sync in real time.
+        // Without BASS_DEVICE_FREQ a real device stays at its own rate, which SFX are converted to when loaded
+        if (!BASS_Init(Config::headless ? 0 : -1, 44100, 0, nullptr, nullptr))
         {
             MessageBoxW(nullptr, L"BASS failed to initialize!", L"BASS Error", MB_ICONERROR);
             return;
         }
+        Latency::PrintDevice();
 
+        BufferMonitor::Init(Config::bufferMinMS, Config::bufferMaxMS);
         Audio::ResetChannels();
+        DecoderPool::SetCapacity(Config::warmDecoders);
+        MusicCache::Init((uint64)Config::musicCacheMB * 1024 * 1024);
+        PCMCache::Init((uint64)Config::pcmCacheMB * 1024 * 1024);
+        DecodeAhead::SetBufferLength(Config::decodeAheadMS);
+        Audio::InitLoader(Config::sfxLoadThreads);
+        if (Config::audioCommandThread)
+            Audio::StartCommandThread();
         ModPathCount = ModLoaderData->GetIncludePaths(nullptr, 0);
         ModPaths = new const char* [ModPathCount];
         ModLoaderData->GetIncludePaths(ModPaths, ModPathCount);
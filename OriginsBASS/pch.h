@@ -8,6 +8,15 @@
 #define PCH_H
 
 // add headers that you want to pre-compile here
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 #include "OriginsBASS.hpp"
 #include "framework.h"
 
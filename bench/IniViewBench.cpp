@@ -0,0 +1,206 @@
+// Times IniView on a synthetic audio.ini loop table against a line-by-line parser that keeps INIReader's layout
+// (one std::map of lowercased "section=key" strings), and checks both give the same loop points.
+//
+//   iniview_bench [--sections N] [--runs N] [file.ini]
+
+#include "IniView.hpp"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace {
+
+    // Same rules as inih with INIReader's defaults, minus multi-line values
+    struct ReferenceIni {
+        std::map<std::string, std::string> values;
+        std::set<std::string> sections;
+
+        static std::string Lower(std::string str) {
+            for (char& c : str)
+                c = (char)tolower((unsigned char)c);
+            return str;
+        }
+
+        static size_t FindCharsOrComment(const std::string& line, size_t from, const char* chars) {
+            bool wasSpace = false;
+            for (size_t i = from; i < line.size(); ++i) {
+                if ((chars && strchr(chars, line[i])) || (wasSpace && line[i] == ';'))
+                    return i;
+                wasSpace = isspace((unsigned char)line[i]) != 0;
+            }
+            return line.size();
+        }
+
+        static std::string Strip(const std::string& str, size_t start, size_t end) {
+            while (start < end && isspace((unsigned char)str[start]))
+                ++start;
+            while (end > start && isspace((unsigned char)str[end - 1]))
+                --end;
+            return str.substr(start, end - start);
+        }
+
+        void Parse(const std::string& text) {
+            std::string section;
+            size_t pos = text.compare(0, 3, "\xEF\xBB\xBF") == 0 ? 3 : 0;
+            while (pos < text.size()) {
+                size_t next = text.find('\n', pos);
+                if (next == std::string::npos)
+                    next = text.size();
+                std::string line = Strip(text, pos, next);
+                pos              = next + 1;
+
+                if (line.empty() || line[0] == ';' || line[0] == '#')
+                    continue;
+                if (line[0] == '[') {
+                    size_t end = FindCharsOrComment(line, 1, "]");
+                    if (end < line.size() && line[end] == ']')
+                        section = line.substr(1, end - 1);
+                    continue;
+                }
+
+                size_t end = FindCharsOrComment(line, 0, "=:");
+                if (end == line.size() || (line[end] != '=' && line[end] != ':'))
+                    continue;
+                std::string name = Strip(line, 0, end);
+                size_t valueStart = end + 1;
+                while (valueStart < line.size() && isspace((unsigned char)line[valueStart]))
+                    ++valueStart;
+                std::string value = Strip(line, valueStart, FindCharsOrComment(line, valueStart, nullptr));
+
+                std::string key = Lower(section) + "=" + Lower(name);
+                if (!values[key].empty())
+                    values[key] += "\n";
+                values[key] += value;
+                sections.insert(section);
+            }
+        }
+
+        long GetInteger(const std::string& section, const std::string& name, long def) const {
+            auto it = values.find(Lower(section) + "=" + Lower(name));
+            if (it == values.end())
+                return def;
+            char* end;
+            long n = strtol(it->second.c_str(), &end, 0);
+            return end > it->second.c_str() ? n : def;
+        }
+    };
+
+    struct LoopPoints {
+        long start;
+        long end;
+        bool operator==(const LoopPoints& other) const { return start == other.start && end == other.end; }
+    };
+
+    // Looks like the loop tables mods ship: one section per track, a few comments and some odd spacing
+    std::string MakeLoopTable(uint32_t sectionCount) {
+        std::string text = "; Loop points for replaced music\n";
+        char line[256];
+        uint32_t seed = 12345;
+        for (uint32_t i = 0; i < sectionCount; ++i) {
+            seed = seed * 1664525 + 1013904223;
+            snprintf(line, sizeof(line), "[Data/Music/Zone%02u/Track%05u_Act%u.ogg]\n", i % 13, i, seed % 3);
+            text += line;
+            if (i % 7 == 0)
+                text += "# alternate mix below\n";
+            snprintf(line, sizeof(line), i % 5 == 0 ? "LoopStart = %u ; measured\n" : "loopStart=%u\n", (seed >> 8) % 5000000);
+            text += line;
+            if (i % 4)
+                snprintf(line, sizeof(line), "loopEnd=%u\n", (seed >> 4) % 9000000 + 5000000);
+            else
+                snprintf(line, sizeof(line), "loopEnd : -1\r\n");
+            text += line;
+            text += "\n";
+        }
+        return text;
+    }
+
+    double Seconds(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+} // namespace
+
+int main(int argc, char** argv) {
+    uint32_t sectionCount = 40000;
+    uint32_t runs         = 20;
+    const char* fileName  = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--sections") && i + 1 < argc)
+            sectionCount = (uint32_t)atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--runs") && i + 1 < argc)
+            runs = (uint32_t)atoi(argv[++i]);
+        else
+            fileName = argv[i];
+    }
+
+    std::string text;
+    if (fileName) {
+        FILE* file = fopen(fileName, "rb");
+        if (!file) {
+            printf("Can't open %s\n", fileName);
+            return 1;
+        }
+        char buffer[4096];
+        size_t got;
+        while ((got = fread(buffer, 1, sizeof(buffer), file)) > 0)
+            text.append(buffer, got);
+        fclose(file);
+    }
+    else {
+        text = MakeLoopTable(sectionCount);
+    }
+
+    // Check first, the same way ParseAllLoopReplacements reads the table
+    ReferenceIni reference;
+    reference.Parse(text);
+    IniView view;
+    view.parse(text.data(), text.size());
+
+    std::vector<std::string_view> groups = view.groups();
+    std::set<std::string> viewSections;
+    for (std::string_view group : groups)
+        viewSections.emplace(group);
+    if (viewSections != reference.sections) {
+        printf("FAIL: %zu sections from IniView, %zu from the reference\n", viewSections.size(), reference.sections.size());
+        return 1;
+    }
+    for (const std::string& section : reference.sections) {
+        LoopPoints expected = { reference.GetInteger(section, "loopStart", -1), reference.GetInteger(section, "loopEnd", -1) };
+        LoopPoints got      = { view.getInt(section, "loopStart", -1), view.getInt(section, "loopEnd", -1) };
+        if (!(expected == got)) {
+            printf("FAIL: [%s] %ld/%ld from IniView, %ld/%ld from the reference\n", section.c_str(), got.start, got.end, expected.start, expected.end);
+            return 1;
+        }
+    }
+    printf("%zu sections, %.2f MB, loop points match\n", groups.size(), text.size() / (1024.0 * 1024.0));
+
+    double referenceBest = 1e9, viewBest = 1e9;
+    long checksum = 0;
+    for (uint32_t run = 0; run < runs; ++run) {
+        auto start = std::chrono::steady_clock::now();
+        ReferenceIni timedReference;
+        timedReference.Parse(text);
+        for (const std::string& section : timedReference.sections)
+            checksum += timedReference.GetInteger(section, "loopStart", -1) + timedReference.GetInteger(section, "loopEnd", -1);
+        referenceBest = std::min(referenceBest, Seconds(start));
+
+        start = std::chrono::steady_clock::now();
+        IniView timedView;
+        timedView.parse(text.data(), text.size());
+        for (std::string_view section : timedView.groups())
+            checksum -= timedView.getInt(section, "loopStart", -1) + timedView.getInt(section, "loopEnd", -1);
+        viewBest = std::min(viewBest, Seconds(start));
+    }
+
+    double megabytes = text.size() / (1024.0 * 1024.0);
+    printf("reference: %8.3f ms  %7.1f MB/s\n", referenceBest * 1000.0, megabytes / referenceBest);
+    printf("IniView:   %8.3f ms  %7.1f MB/s  (%.1fx)\n", viewBest * 1000.0, megabytes / viewBest, referenceBest / viewBest);
+    return checksum == 0 ? 0 : 1;
+}